@@ -5,11 +5,17 @@
  * Copyright (c) 2019 asvin.io. All rights reserved.
  */
 #include "Asvin.h"
+#include "AsvinSlot.h"
 #include <Arduino.h>
 
 
 
-Asvin::Asvin(void) {
+// kept through deep sleep so waking up does not push the slot back
+static RTC_DATA_ATTR asvin_slot_t rolloutSlot;
+
+
+Asvin::Asvin(void)
+  : _rootCA(NULL), _fragmentLength(ASVIN_TLS_FRAGMENT_LENGTH), _rolloutWindow(ASVIN_ROLLOUT_WINDOW) {
 
 }
 Asvin::~Asvin(void) {
@@ -17,10 +23,53 @@ Asvin::~Asvin(void) {
 }
 
 
+void Asvin::setCACert(const char* rootCA) {
+  _rootCA = rootCA;
+}
+
+
+void Asvin::setTlsFragmentLength(uint16_t len) {
+  _fragmentLength = len;
+}
+
+
+void Asvin::setRolloutWindow(uint32_t seconds) {
+  _rolloutWindow = seconds;
+}
+
+
+void Asvin::setupClient(AsvinTlsClient& client) {
+  client.setCACert(_rootCA);
+  client.setMaxFragmentLength(_fragmentLength);
+}
+
+
+void Asvin::collectDate(HTTPClient& http) {
+  // the Date header sets the clock while SNTP has not answered yet
+  const char* headerKeys[] = { "Date" };
+  http.collectHeaders(headerKeys, 1);
+}
+
+
+bool Asvin::fetchServerTime(void) {
+  AsvinTlsClient client;
+  setupClient(client);
+  HTTPClient http;
+  http.begin(client, authserverURL);
+  collectDate(http);
+  int httpCode = http.sendRequest("HEAD");
+  bool set = httpCode > 0 && asvinClock.setFromHttpDate(http.header("Date"));
+  http.end();
+  return set;
+}
+
+
 String Asvin::authLogin(String device_key, String device_signature, long unsigned int timestamp, int& httpCode) {
-  std::unique_ptr<WiFiClientSecure> client(new WiFiClientSecure);
+  AsvinTlsClient client;
+  setupClient(client);
   HTTPClient http;
-  http.begin(*client, authserverLoginURL);
+  http.begin(client, authserverLoginURL);
+  collectDate(http);
   http.addHeader(F("Content-Type"), "application/json");
   DynamicJsonDocument doc(500);
   doc["device_key"] = device_key;
@@ -32,6 +81,7 @@ String Asvin::authLogin(String device_key, String device_signature, long unsigne
   payload.toCharArray(buff, payload.length() + 1);
   DEBUG_ASVIN_UPDATE("[asvin auth server] Auth Server Login : %s\n", buff);
   httpCode = http.POST(payload);   //Send the request
+  asvinClock.setFromHttpDate(http.header("Date"));
   delay(1000);
   String res = http.getString();  //Get the response payload
   delay(1000);
@@ -41,9 +91,11 @@ String Asvin::authLogin(String device_key, String device_signature, long unsigne
 
 
 String Asvin::registerDevice(const String name, const String mac, String currentFwVersion, String token, int& httpCode) {
-  std::unique_ptr<WiFiClientSecure> client(new WiFiClientSecure);
+  AsvinTlsClient client;
+  setupClient(client);
   HTTPClient http;
-  http.begin(*client, registerURL);
+  http.begin(client, registerURL);
+  collectDate(http);
   http.addHeader(F("Content-Type"), "application/json");
   http.addHeader(F("x-access-token"), token);
   DynamicJsonDocument doc(500);
@@ -56,6 +108,7 @@ String Asvin::registerDevice(const String name, const String mac, String current
   payload.toCharArray(buff, payload.length() + 1);
   DEBUG_ASVIN_UPDATE("[asvin Version Controller] Register Device  : %s\n", buff);
   httpCode = http.POST(payload);   //Send the request
+  asvinClock.setFromHttpDate(http.header("Date"));
   delay(1000);
   String res = http.getString();  //Get the response payload
   delay(1000);
@@ -65,11 +118,14 @@ String Asvin::registerDevice(const String name, const String mac, String current
 
 
 String Asvin::checkRollout(const String mac, const String currentFwVersion, String token, int& httpCode) {
-  std::unique_ptr<WiFiClientSecure> client(new WiFiClientSecure);
+  AsvinTlsClient client;
+  setupClient(client);
   HTTPClient http;
-  http.begin(*client, checkRolloutURL);
+  http.begin(client, checkRolloutURL);
+  collectDate(http);
   http.addHeader(F("Content-Type"), "application/json");
   http.addHeader(F("x-access-token"), token);
+  http.setReuse(true);
   DynamicJsonDocument doc(500);
   doc["mac"] = mac;
   doc["firmware_version"] = currentFwVersion;
@@ -79,20 +135,57 @@ String Asvin::checkRollout(const String mac, const String currentFwVersion, Stri
   payload.toCharArray(buff, payload.length() + 1);
   DEBUG_ASVIN_UPDATE("[asvinUpdate] Next RollOut ---> : %s\n", buff);
   httpCode = http.POST(payload); //Send the request
+  asvinClock.setFromHttpDate(http.header("Date"));
   delay(1000);
   String res = http.getString();  //Get the response payload
   delay(1000);
-  http.end();  //Close connection to asvin server
+  http.end();  //Keeps the connection if the server allows it
+  // the connection is open anyway, deliver what earlier attempts could not
+  if (httpCode == 200 && asvinReports.pending()) {
+    int reportCode;
+    sendReports(client, mac, token, reportCode);
+  }
+  client.stop();  //Close connection to asvin server
   return res;
 }
 
 
 
 
+uint32_t Asvin::slotOffset(const String& mac, const String& rolloutID, uint32_t window) {
+  return asvinSlotOffset(mac.c_str(), rolloutID.c_str(), window);
+}
+
+
+uint32_t Asvin::rolloutSlotDelay(const String& rollout, const String& mac) {
+  DynamicJsonDocument doc(1000);
+  if (deserializeJson(doc, rollout)) {
+    return 0;
+  }
+  String rolloutID = doc["rollout_id"];
+  time_t now = asvinClock.now();
+  if (!now || rolloutID == "null") {
+    return 0;
+  }
+  uint32_t window = doc["rollout_window"] | _rolloutWindow;
+  uint32_t offset = doc.containsKey("rollout_slot") ? doc["rollout_slot"].as<uint32_t>() : slotOffset(mac, rolloutID, window);
+  time_t start = doc["rollout_start"].as<long>();
+  if (!start) {
+    // without a campaign start the window opens when the device first sees the rollout
+    start = asvinSlotSeen(rolloutSlot, rolloutID.c_str(), now);
+  }
+  time_t at = start + offset;
+  DEBUG_ASVIN_UPDATE("[asvinUpdate] Rollout %s slot at +%u s of %u s\n", rolloutID.c_str(), offset, window);
+  return at > now ? (uint32_t)(at - now) : 0;
+}
+
+
 String Asvin::getBlockchainCID(const String firmwareID, String token, int& httpCode) {
-  std::unique_ptr<WiFiClientSecure> client(new WiFiClientSecure);
+  AsvinTlsClient client;
+  setupClient(client);
   HTTPClient http;
-  http.begin(*client, bcGetFirmwareURL);
+  http.begin(client, bcGetFirmwareURL);
+  collectDate(http);
   http.addHeader(F("Content-Type"), "application/json");
   http.addHeader(F("x-access-token"), token);
   DynamicJsonDocument doc(256);
@@ -103,6 +196,7 @@ String Asvin::getBlockchainCID(const String firmwareID, String token, int& httpC
   payload.toCharArray(buff, payload.length() + 1);
   DEBUG_ASVIN_UPDATE("[asvinUpdate] Blockchain Login : %s\n", buff);
   httpCode = http.POST(payload);   //Send the request
+  asvinClock.setFromHttpDate(http.header("Date"));
   delay(1000);
   String res = http.getString();  //Get the response payload
   delay(1000);
@@ -112,9 +206,11 @@ String Asvin::getBlockchainCID(const String firmwareID, String token, int& httpC
 
 
 String Asvin::checkRolloutSuccess(const String mac, const String currentFwVersion, String token, const String rolloutID, int& httpCode) {
-  std::unique_ptr<WiFiClientSecure> client(new WiFiClientSecure);
+  AsvinTlsClient client;
+  setupClient(client);
   HTTPClient http;
-  http.begin(*client, checkRolloutSuccessURL);
+  http.begin(client, checkRolloutSuccessURL);
+  collectDate(http);
   http.addHeader(F("Content-Type"), "application/json");
   http.addHeader(F("x-access-token"), token);
   DynamicJsonDocument doc(256);
@@ -127,6 +223,7 @@ String Asvin::checkRolloutSuccess(const String mac, const String currentFwVersio
   payload.toCharArray(buff, payload.length() + 1);
   DEBUG_ASVIN_UPDATE("[asvinUpdate] Check Rollout Success  : %s\n", buff);
   httpCode = http.POST(payload);   //Send the request
+  asvinClock.setFromHttpDate(http.header("Date"));
   delay(1000);
   String res = http.getString();  //Get the response payload
   delay(1000);
@@ -136,8 +233,120 @@ String Asvin::checkRolloutSuccess(const String mac, const String currentFwVersio
 
 
 
+bool Asvin::reportRollout(const String mac, const String currentFwVersion, String token, const String rolloutID, t_httpUpdate_return result, int& httpCode, const String cid) {
+  httpCode = 0;
+  // only the success endpoint is known, a failed rollout is simply offered again
+  if (result == HTTP_UPDATE_FAILED) {
+    return true;
+  }
+  // an image already in flash is offered on every check until it runs, one report covers it
+  if (result == HTTP_UPDATE_NO_UPDATES && asvinReports.contains(rolloutID.c_str())) {
+    return true;
+  }
+  asvin_report_t report;
+  memset(&report, 0, sizeof(report));
+  strlcpy(report.rolloutID, rolloutID.c_str(), sizeof(report.rolloutID));
+  strlcpy(report.version, currentFwVersion.c_str(), sizeof(report.version));
+  report.result = HTTP_UPDATE_OK;
+  report.stageTime = result == HTTP_UPDATE_OK ? httpUpdate.getStageTime() : 0;
+  report.startupTime = asvinStartup.profile().at[ASVIN_STARTUP_FIRST_REQUEST];
+  if (cid.length()) {
+    // success means the image runs, not that it reached flash
+    strlcpy(report.tag, ("\"" + cid + "\"").c_str(), sizeof(report.tag));
+  }
+  asvinReports.push(report);
+
+  AsvinTlsClient client;
+  setupClient(client);
+  bool sent = sendReports(client, mac, token, httpCode);
+  client.stop();
+  return sent;
+}
+
+
+/*
+ * a success report waits while its image is staged or set to boot, and
+ * turns into a failure, which is dropped, once the image is in none of these partitions
+ */
+static bool reportDeferred(asvin_report_t& report, const String& installedTag) {
+  if (report.result != HTTP_UPDATE_OK || !report.tag[0] || installedTag == report.tag) {
+    return false;
+  }
+  if (httpUpdate.isInstalled(report.tag)) {
+    return true;
+  }
+  log_w("[asvinUpdate] Image of rollout %s was never activated\n", report.rolloutID);
+  report.result = HTTP_UPDATE_FAILED;
+  return false;
+}
+
+
+bool Asvin::sendReports(AsvinTlsClient& client, const String& mac, const String& token, int& httpCode) {
+  asvin_report_t report;
+  String installedTag = httpUpdate.getInstalledTag();
+  size_t index = 0;
+  httpCode = 0;
+  while (asvinReports.get(index, report)) {
+    if (reportDeferred(report, installedTag)) {
+      index++;
+      continue;
+    }
+    if (report.result != HTTP_UPDATE_OK) {
+      // a failure has no endpoint, also covers records queued by older firmware
+      asvinReports.remove(index);
+      continue;
+    }
+    // keep-alive: every report after the first goes over the same TLS session
+    HTTPClient http;
+    http.setReuse(true);
+    http.begin(client, checkRolloutSuccessURL);
+    http.addHeader(F("Content-Type"), "application/json");
+    http.addHeader(F("x-access-token"), token);
+    DynamicJsonDocument doc(384);
+    doc["mac"] = mac;
+    doc["firmware_version"] = report.version;
+    doc["rollout_id"] = report.rolloutID;
+    doc["stage_time"] = report.stageTime;
+    doc["startup_time"] = report.startupTime;
+    String payload;
+    serializeJson(doc, payload);
+    DEBUG_ASVIN_UPDATE("[asvinUpdate] Rollout report : %s\n", payload.c_str());
+    httpCode = http.POST(payload);
+    http.getString();
+    http.end();
+    if (httpCode == 200) {
+      asvinReports.remove(index);
+    } else if (httpCode >= 400 && httpCode < 500 && httpCode != 401 && httpCode != 403) {
+      // the server will never take this one, e.g. the rollout is gone
+      log_w("[asvinUpdate] Rollout report for %s rejected (%d), dropped\n", report.rolloutID, httpCode);
+      asvinReports.remove(index);
+    } else {
+      // offline or the token expired, keep it for the next connection
+      return false;
+    }
+  }
+  return true;
+}
+
+
+bool Asvin::alreadyInstalled(const String cid) {
+  // the CID doubles as entity tag, so a server knowing it can also answer 304
+  String tag = "\"" + cid + "\"";
+  if (httpUpdate.isInstalled(tag)) {
+    DEBUG_ASVIN_UPDATE("[asvinUpdate] Firmware %s is already installed\n", cid.c_str());
+    return true;
+  }
+  httpUpdate.setImageTag(tag);
+  return false;
+}
+
+
 t_httpUpdate_return Asvin::downloadFirmware(String token, const String cid) {
-  std::unique_ptr<WiFiClientSecure> client(new WiFiClientSecure);
+  if (alreadyInstalled(cid)) {
+    return HTTP_UPDATE_NO_UPDATES;
+  }
+  AsvinTlsClient client;
+  setupClient(client);
   StaticJsonDocument<80> doc;
   doc["cid"] = cid;
   String payload;
@@ -146,8 +355,104 @@ t_httpUpdate_return Asvin::downloadFirmware(String token, const String cid) {
   char buff[payload.length() + 1];
   payload.toCharArray(buff, payload.length() + 1);
   DEBUG_ASVIN_UPDATE("[asvinUpdate] Download firmware HTTP payload : %s\n", buff);
-  t_httpUpdate_return res = httpUpdate.update(*client, ipfsDownloadURL, payload, token, currentVersion);
+  t_httpUpdate_return res = httpUpdate.update(client, ipfsDownloadURL, payload, token, currentVersion);
   return res;
 }
 
 
+t_httpUpdate_return Asvin::benchmarkDownload(String token, const String cid, HTTPUpdateSink sink, HTTPUpdateTimings& timings) {
+  AsvinTlsClient client;
+  setupClient(client);
+  client.resetTimes();
+  StaticJsonDocument<80> doc;
+  doc["cid"] = cid;
+  String payload;
+  serializeJson(doc, payload);
+  DEBUG_ASVIN_UPDATE("[asvinUpdate] Benchmark download of firmware %s\n", cid.c_str());
+  httpUpdate.setSink(sink);
+  t_httpUpdate_return res = httpUpdate.update(client, ipfsDownloadURL, payload, token, "1.0.0");
+  httpUpdate.setSink(HTTP_UPDATE_SINK_FLASH);
+  timings = httpUpdate.getTimings();
+  // only the transport can tell which part of the receive time went into TLS
+  timings.decrypt = client.decryptTime();
+  return res;
+}
+
+
+bool Asvin::downloadFirmwareInBackground(String token, const String cid, uint32_t bytesPerSecond, HTTPUpdateDoneCallback done) {
+  if (alreadyInstalled(cid)) {
+    if (done) {
+      done(HTTP_UPDATE_NO_UPDATES);
+    }
+    return true;
+  }
+  const char* rootCA = _rootCA;
+  uint16_t fragmentLength = _fragmentLength;
+  const String url = ipfsDownloadURL;
+  httpUpdate.setBandwidthLimit(bytesPerSecond);
+  httpUpdate.setIdleBandwidthLimit(bytesPerSecond);
+  DEBUG_ASVIN_UPDATE("[asvinUpdate] Download firmware %s in background at %u B/s\n", cid.c_str(), bytesPerSecond);
+  // the task may outlive this object, so it gets copies of everything it needs
+  return httpUpdate.runInBackground([token, cid, url, rootCA, fragmentLength]() {
+    AsvinTlsClient client;
+    client.setCACert(rootCA);
+    client.setMaxFragmentLength(fragmentLength);
+    StaticJsonDocument<80> doc;
+    doc["cid"] = cid;
+    String payload;
+    serializeJson(doc, payload);
+    return httpUpdate.update(client, url, payload, token, "1.0.0");
+  }, done);
+}
+
+
+t_httpUpdate_return Asvin::downloadFirmware(const String cid, const String gateways[], size_t count) {
+  uint8_t sha256[32];
+  if (count && !cidRawSha256(cid.c_str(), sha256)) {
+    // the file of a dag-pb CID has no digest of its own, only block by block verification works
+    return downloadFirmwareVerified(cid, gateways[0]);
+  }
+  if (alreadyInstalled(cid)) {
+    return HTTP_UPDATE_NO_UPDATES;
+  }
+  String urls[RANGE_STREAM_MAX_SOURCES];
+  if (count > RANGE_STREAM_MAX_SOURCES) {
+    count = RANGE_STREAM_MAX_SOURCES;
+  }
+  for (size_t i = 0; i < count; i++) {
+    urls[i] = gateways[i] + cid;
+  }
+  DEBUG_ASVIN_UPDATE("[asvinUpdate] Download firmware %s from %u gateways\n", cid.c_str(), count);
+  const String currentVersion = "1.0.0";
+  httpUpdate.setMirrorCACert(_rootCA);
+  return httpUpdate.updateFromMirrors(urls, count, sha256, currentVersion);
+}
+
+
+t_httpUpdate_return Asvin::downloadFirmwareCached(const String cid, const String urlTemplate) {
+  if (alreadyInstalled(cid)) {
+    return HTTP_UPDATE_NO_UPDATES;
+  }
+  DEBUG_ASVIN_UPDATE("[asvinUpdate] Download firmware %s from %s\n", cid.c_str(), urlTemplate.c_str());
+  const String currentVersion = "1.0.0";
+  return httpUpdate.updateFromCid(urlTemplate, cid, currentVersion);
+}
+
+
+t_httpUpdate_return Asvin::downloadFirmwareVerified(const String cid, const String gateway, AsvinPeerCache* peers) {
+  if (alreadyInstalled(cid)) {
+    return HTTP_UPDATE_NO_UPDATES;
+  }
+  DEBUG_ASVIN_UPDATE("[asvinUpdate] Download firmware %s block by block from %s\n", cid.c_str(), gateway.c_str());
+  const String currentVersion = "1.0.0";
+  if (peers) {
+    return peers->download(cid, gateway, currentVersion);
+  }
+  if (gateway.startsWith("https")) {
+    AsvinTlsClient client;
+    setupClient(client);
+    return httpUpdate.updateFromCar(client, gateway, cid, currentVersion);
+  }
+  WiFiClient client;
+  return httpUpdate.updateFromCar(client, gateway, cid, currentVersion);
+}
@@ -11,6 +11,14 @@
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include "HTTPUpdate.h"
+#include "AsvinPeerCache.h"
+#include "AsvinTlsClient.h"
+#include "AsvinSigner.h"
+#include "AsvinClock.h"
+#include "AsvinSleep.h"
+#include "AsvinStartup.h"
+#include "AsvinService.h"
+#include "AsvinReports.h"
 #include <WiFiClientSecure.h>
 #include <WiFiClient.h>
 
@@ -23,6 +31,9 @@
 #define DEBUG_ASVIN_UPDATE(...)
 #endif
 
+// seconds over which the devices of a rollout spread their downloads, unless the server sets it
+#define ASVIN_ROLLOUT_WINDOW  600
+
 class Asvin
 {
 public:
@@ -33,14 +44,53 @@ public:
   String authLogin(String customer_key, String device_signature, long unsigned int timestamp, int& httpCode);
   String getBlockchainCID(const String firmwareID, String token, int& httpCode);
   String checkRolloutSuccess(const String mac, const String currentFwVersion, String token, const String rollout_id, int& httpCode);
+  // queue the success of a rollout and send it, with any reports still pending, over one connection.
+  // NO_UPDATES (image already in flash) counts as success and is queued once per rollout; failures are
+  // not reported, the server offers the rollout again. With the cid, a success is only sent once that
+  // image runs. false if a report could not be delivered, it is sent again with the next checkRollout
+  bool reportRollout(const String mac, const String currentFwVersion, String token, const String rolloutID, t_httpUpdate_return result, int& httpCode, const String cid = String());
+  // seconds until this device's download slot for the rollout in a checkRollout response, 0 to download now.
+  // honours "rollout_start" (epoch), "rollout_window" and "rollout_slot" (seconds) when the server sends them
+  uint32_t rolloutSlotDelay(const String& rollout, const String& mac);
+  // 0 downloads as soon as a rollout is seen
+  void setRolloutWindow(uint32_t seconds);
+  // deterministic offset in [0, window) of a device within a rollout
+  static uint32_t slotOffset(const String& mac, const String& rolloutID, uint32_t window);
   t_httpUpdate_return downloadFirmware(String token, const String cid);
+  // same download without writing flash, timings tell how receive, TLS, hashing and writing share the time
+  t_httpUpdate_return benchmarkDownload(String token, const String cid, HTTPUpdateSink sink, HTTPUpdateTimings& timings);
+  // same download in an idle priority task capped to bytesPerSecond, busy or idle
+  bool downloadFirmwareInBackground(String token, const String cid, uint32_t bytesPerSecond, HTTPUpdateDoneCallback done = nullptr);
+  // fetch the image by CID from public IPFS gateways, e.g. "https://ipfs.io/ipfs/", checked against the
+  // digest of a raw CID; other CIDs go block by block through the first gateway (downloadFirmwareVerified)
+  t_httpUpdate_return downloadFirmware(const String cid, const String gateways[], size_t count);
+  // fetch the image by raw CID with cacheable GETs, e.g. from a signed CDN URL "https://cdn.example/fw/{cid}?sig=...",
+  // checked against the digest in the CID
+  t_httpUpdate_return downloadFirmwareCached(const String cid, const String urlTemplate);
+  // fetch the image by CID as a CAR and verify every block against the CID, trying LAN peers first if given
+  t_httpUpdate_return downloadFirmwareVerified(const String cid, const String gateway, AsvinPeerCache* peers = NULL);
+  // set asvinClock from the Date of a HEAD request, for when SNTP has not answered yet
+  bool fetchServerTime(void);
+  // PEM root certificate for the asvin servers, unset the servers are not authenticated
+  void setCACert(const char* rootCA);
+  // TLS max fragment length to ask for (512..4096), 0 disables it
+  void setTlsFragmentLength(uint16_t len);
 
 
 private:
+  void setupClient(AsvinTlsClient& client);
+  void collectDate(HTTPClient& http);
+  bool alreadyInstalled(const String cid);
+  bool sendReports(AsvinTlsClient& client, const String& mac, const String& token, int& httpCode);
+
+  const char* _rootCA;
+  uint16_t _fragmentLength;
+  uint32_t _rolloutWindow;
 
   const String registerURL = "https://app.vc.asvin.io/api/device/register";
   const String checkRolloutURL = "https://app.vc.asvin.io/api/device/next/rollout";
   const String checkRolloutSuccessURL = "https://app.vc.asvin.io/api/device/success/rollout";
+  const String authserverURL = "https://app.auth.asvin.io/";
   const String authserverLoginURL = "https://app.auth.asvin.io/auth/login";
   const String bcGetFirmwareURL = "https://app.besu.asvin.io/firmware/get";
   const String ipfsDownloadURL = "https://app.ipfs.asvin.io/firmware/download";
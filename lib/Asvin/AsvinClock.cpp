@@ -0,0 +1,82 @@
+/**
+ * AsvinClock.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinClock.h"
+#include "AsvinStartup.h"
+#include "AsvinHttpDate.h"
+#include <sys/time.h>
+#include "apps/sntp/sntp.h"
+
+
+AsvinClock::AsvinClock(void)
+  : _last(0), _lastMillis(0) {
+}
+
+void AsvinClock::begin(const char* server, long gmtOffset, int daylightOffset) {
+  configTime(gmtOffset, daylightOffset, server);
+}
+
+time_t AsvinClock::now(void) {
+  time_t t = time(NULL);
+  if (t < ASVIN_CLOCK_VALID_AFTER) {
+    return 0;
+  }
+  checkSync();
+  unsigned long ms = millis();
+  // a sync may step the clock back a little, timestamps must not follow but keep moving
+  if (t < _last) {
+    unsigned long elapsed = ms - _lastMillis;
+    _last += elapsed / 1000;
+    _lastMillis = ms - elapsed % 1000;
+    return _last;
+  }
+  _last = t;
+  _lastMillis = ms;
+  return t;
+}
+
+// a valid time alone may be left over from before a deep sleep, only an answer from the server counts
+void AsvinClock::checkSync(void) {
+  if (asvinStartup.reached(ASVIN_STARTUP_TIME_SYNCED) || !sntp_enabled()) {
+    return;
+  }
+#if SNTP_MONITOR_SERVER_REACHABILITY
+  if (sntp_getreachability(0)) {
+    asvinStartup.mark(ASVIN_STARTUP_TIME_SYNCED);
+  }
+#endif
+}
+
+bool AsvinClock::valid(void) {
+  return now() != 0;
+}
+
+bool AsvinClock::localTime(struct tm* info) {
+  time_t t = now();
+  if (!t) {
+    return false;
+  }
+  localtime_r(&t, info);
+  return true;
+}
+
+bool AsvinClock::setFromHttpDate(const String& date) {
+  if (valid() || date.length() == 0) {
+    return false;
+  }
+  time_t t = asvinParseHttpDate(date.c_str());
+  if (t < ASVIN_CLOCK_VALID_AFTER) {
+    return false;
+  }
+  struct timeval tv = { t, 0 };
+  settimeofday(&tv, NULL);
+  asvinStartup.mark(ASVIN_STARTUP_TIME_SYNCED);
+  log_d("[asvin clock] set from HTTP Date: %s\n", date.c_str());
+  return true;
+}
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_ASVINCLOCK)
+AsvinClock asvinClock;
+#endif
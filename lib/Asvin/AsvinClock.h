@@ -0,0 +1,54 @@
+/**
+ * AsvinClock.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_CLOCK_H_
+#define ASVIN_CLOCK_H_
+
+#include <Arduino.h>
+#include <time.h>
+
+// earlier times mean the clock was never set (2020-01-01)
+#define ASVIN_CLOCK_VALID_AFTER   1577836800
+
+/*
+ * wall clock for request timestamps that never waits on the network
+ *
+ * begin() starts SNTP once, lwIP then re-syncs on its own interval
+ * (SNTP_UPDATE_DELAY, one hour in the Arduino build). Until the first
+ * answer arrives, the Date header of any asvin response sets the clock.
+ * now() never goes backwards, even when a sync steps the system time;
+ * after a step back it counts on with millis() until the system time has
+ * caught up. The rate is not slewed, a step forward is passed on as is.
+ */
+class AsvinClock
+{
+public:
+  AsvinClock(void);
+
+  void begin(const char* server, long gmtOffset, int daylightOffset);
+
+  // seconds since the epoch, 0 while the time is unknown
+  time_t now(void);
+  bool valid(void);
+  // local time (TZ from begin), false while the time is unknown
+  bool localTime(struct tm* info);
+
+  // "Sun, 06 Nov 1994 08:49:37 GMT", only used while SNTP has not answered
+  bool setFromHttpDate(const String& date);
+
+private:
+  // marks the time synced milestone once SNTP has answered
+  void checkSync(void);
+
+  time_t _last;
+  // millis() at _last, less the part of a second not yet counted
+  unsigned long _lastMillis;
+};
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_ASVINCLOCK)
+extern AsvinClock asvinClock;
+#endif
+
+#endif
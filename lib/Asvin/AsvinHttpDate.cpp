@@ -0,0 +1,37 @@
+/**
+ * AsvinHttpDate.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinHttpDate.h"
+#include <stdio.h>
+#include <string.h>
+
+// days since 1970-01-01 of a proleptic Gregorian date
+static long daysFromCivil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (long)doe - 719468;
+}
+
+time_t asvinParseHttpDate(const char* date) {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  char month[4];
+  int day, year, hour, minute, second;
+  if (sscanf(date, "%*3s, %d %3s %d %d:%d:%d", &day, month, &year, &hour, &minute, &second) != 6) {
+    return 0;
+  }
+  const char* found = strstr(months, month);
+  if (!found || strlen(month) != 3 || (found - months) % 3 != 0) {
+    return 0;
+  }
+  if (day < 1 || day > 31 || year < 1970 || hour > 23 || minute > 59 || second > 60
+      || hour < 0 || minute < 0 || second < 0) {
+    return 0;
+  }
+  unsigned m = (found - months) / 3 + 1;
+  return (time_t)daysFromCivil(year, m, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
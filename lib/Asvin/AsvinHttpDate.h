@@ -0,0 +1,19 @@
+/**
+ * AsvinHttpDate.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_HTTP_DATE_H_
+#define ASVIN_HTTP_DATE_H_
+
+#include <time.h>
+
+/*
+ * HTTP Date header parsing for AsvinClock, free of the framework so the
+ * native tests build it
+ */
+
+// seconds since the epoch of "Sun, 06 Nov 1994 08:49:37 GMT" (IMF-fixdate), 0 if it does not parse
+time_t asvinParseHttpDate(const char* date);
+
+#endif
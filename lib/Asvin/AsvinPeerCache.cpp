@@ -0,0 +1,366 @@
+/**
+ * AsvinPeerCache.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinPeerCache.h"
+#include <ESPmDNS.h>
+#include <Preferences.h>
+#include "AsvinTlsClient.h"
+#include <esp_partition.h>
+#include <esp_ota_ops.h>
+
+#define MANIFEST_VERSION  1
+
+static size_t putVarint(uint8_t* out, uint64_t value) {
+  size_t len = 0;
+  do {
+    out[len] = value & 0x7f;
+    value >>= 7;
+    if (value) {
+      out[len] |= 0x80;
+    }
+    len++;
+  } while (value);
+  return len;
+}
+
+static bool sameCid(const uint8_t* a, uint8_t aLen, const uint8_t* b, uint8_t bLen) {
+  // CIDv0 and its CIDv1 form name the same block
+  return cidToString(a, aLen) == cidToString(b, bLen);
+}
+
+static uint32_t getU32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+AsvinPeerCache::AsvinPeerCache(uint16_t port)
+  : _server(port), _port(port), _serving(false), _manifest(NULL), _manifestLen(0), _entriesOffset(0),
+    _recordOverflow(false), _recordSize(0) {
+  mbedtls_sha256_init(&_recordSha);
+}
+
+AsvinPeerCache::~AsvinPeerCache(void) {
+  mbedtls_sha256_free(&_recordSha);
+  free(_manifest);
+}
+
+
+bool AsvinPeerCache::begin(const char* hostname) {
+  if (!MDNS.begin(hostname)) {
+    log_e("mDNS start failed\n");
+    return false;
+  }
+  _server.onNotFound([this]() {
+    handleRequest();
+  });
+  _server.begin();
+
+  _serving = load();
+  if (_serving) {
+    MDNS.addService(ASVIN_PEER_SERVICE, "tcp", _port);
+    MDNS.addServiceTxt(ASVIN_PEER_SERVICE, "tcp", "cid", cid().c_str());
+    log_i("serving %s to peers on port %u\n", cid().c_str(), _port);
+  }
+  return true;
+}
+
+
+void AsvinPeerCache::handleClient(void) {
+  _server.handleClient();
+}
+
+
+String AsvinPeerCache::cid(void) const {
+  if (!_serving) {
+    return String();
+  }
+  String text;
+  for (uint8_t i = 0; i < _manifest[1]; i++) {
+    text += (char)_manifest[2 + i];
+  }
+  return text;
+}
+
+
+t_httpUpdate_return AsvinPeerCache::download(const String& cid, const String& gateway, const String& currentVersion) {
+  httpUpdate.onCarBlock([this](const uint8_t* blockCid, uint8_t cidLen, const uint8_t* block, size_t blockLen, bool raw,
+                               const uint8_t* data, size_t dataLen) {
+    record(blockCid, cidLen, block, blockLen, raw, data, dataLen);
+  });
+
+  t_httpUpdate_return ret = HTTP_UPDATE_FAILED;
+  int found = MDNS.queryService(ASVIN_PEER_SERVICE, "tcp");
+  for (int i = 0, tried = 0; i < found && tried < ASVIN_PEER_MAX_PEERS && ret != HTTP_UPDATE_OK; i++) {
+    if (MDNS.txt(i, "cid") != cid || MDNS.IP(i) == WiFi.localIP()) {
+      continue;
+    }
+    tried++;
+    String peer = "http://" + MDNS.IP(i).toString() + ":" + String(MDNS.port(i)) + "/ipfs/";
+    log_i("fetching %s from peer %s\n", cid.c_str(), peer.c_str());
+    WiFiClient client;
+    reset();
+    ret = httpUpdate.updateFromCar(client, peer, cid, currentVersion);
+  }
+
+  if (ret != HTTP_UPDATE_OK) {
+    std::unique_ptr<WiFiClient> client(gateway.startsWith("https") ? new AsvinTlsClient : new WiFiClient);
+    reset();
+    ret = httpUpdate.updateFromCar(*client, gateway, cid, currentVersion);
+  }
+  httpUpdate.onCarBlock(nullptr);
+
+  if (ret == HTTP_UPDATE_OK) {
+    // root text goes in front so peers can match the CID as the platform hands it out
+    size_t textLen = cid.length();
+    if (!_recordOverflow && _manifestLen > 0 && _manifestLen + textLen <= ASVIN_PEER_MANIFEST_MAX) {
+      memmove(_manifest + 2 + textLen, _manifest + 2, _manifestLen - 2);
+      memcpy(_manifest + 2, cid.c_str(), textLen);
+      _manifest[1] = textLen;
+      _manifestLen += textLen;
+      _entriesOffset += textLen;
+      commit();
+    }
+  }
+  return ret;
+}
+
+
+void AsvinPeerCache::reset(void) {
+  _serving = false;
+  if (!_manifest) {
+    _manifest = (uint8_t*)malloc(ASVIN_PEER_MANIFEST_MAX);
+  }
+  _manifestLen = 0;
+  _entriesOffset = 0;
+  _recordOverflow = (_manifest == NULL);
+  _recordSize = 0;
+  mbedtls_sha256_starts_ret(&_recordSha, 0);
+}
+
+
+void AsvinPeerCache::record(const uint8_t* cid, uint8_t cidLen, const uint8_t* block, size_t blockLen, bool raw,
+                            const uint8_t* data, size_t dataLen) {
+  if (_recordOverflow) {
+    return;
+  }
+  if (_manifestLen == 0) {
+    // version, root text length (filled in on commit), image size and SHA-256 (filled in on commit)
+    uint8_t header[2 + 4 + 32] = { MANIFEST_VERSION, 0 };
+    append(header, sizeof(header));
+    _entriesOffset = _manifestLen;
+  }
+
+  uint8_t entry[2 + 4 + 4];
+  entry[0] = raw;
+  entry[1] = cidLen;
+  memcpy(entry + 2, &blockLen, 4);
+  memcpy(entry + 6, &dataLen, 4);
+  append(entry, 2);
+  append(cid, cidLen);
+  append(entry + 2, 8);
+  if (!raw) {
+    append(block, blockLen);
+  }
+
+  mbedtls_sha256_update_ret(&_recordSha, data, dataLen);
+  _recordSize += dataLen;
+}
+
+
+bool AsvinPeerCache::append(const void* data, size_t len) {
+  if (_recordOverflow || _manifestLen + len > ASVIN_PEER_MANIFEST_MAX) {
+    _recordOverflow = true;
+    return false;
+  }
+  memcpy(_manifest + _manifestLen, data, len);
+  _manifestLen += len;
+  return true;
+}
+
+
+bool AsvinPeerCache::commit(void) {
+  uint8_t* summary = _manifest + 2 + _manifest[1];
+  memcpy(summary, &_recordSize, 4);
+  mbedtls_sha256_finish_ret(&_recordSha, summary + 4);
+
+  Preferences prefs;
+  prefs.begin("asvin-peer", false);
+  bool ok = prefs.putBytes("manifest", _manifest, _manifestLen) == _manifestLen;
+  prefs.end();
+  log_i("peer manifest for %u bytes stored: %d\n", _recordSize, ok);
+  return ok;
+}
+
+
+bool AsvinPeerCache::load(void) {
+  Preferences prefs;
+  prefs.begin("asvin-peer", true);
+  size_t len = prefs.getBytesLength("manifest");
+  if (len == 0 || len > ASVIN_PEER_MANIFEST_MAX) {
+    prefs.end();
+    return false;
+  }
+  free(_manifest);
+  _manifest = (uint8_t*)malloc(ASVIN_PEER_MANIFEST_MAX);
+  if (!_manifest) {
+    prefs.end();
+    return false;
+  }
+  _manifestLen = prefs.getBytes("manifest", _manifest, len);
+  prefs.end();
+
+  if (_manifestLen != len || _manifest[0] != MANIFEST_VERSION || len < 2u + _manifest[1] + 36) {
+    return false;
+  }
+  const uint8_t* summary = _manifest + 2 + _manifest[1];
+  _entriesOffset = 2 + _manifest[1] + 36;
+
+  // only serve the manifest if it describes the image that is running now
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  uint32_t size = getU32(summary);
+  if (!running || size == 0 || size > running->size) {
+    return false;
+  }
+  uint8_t buf[1024];
+  uint8_t sha256[32];
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  for (uint32_t offset = 0; offset < size; offset += sizeof(buf)) {
+    uint32_t n = min((uint32_t)sizeof(buf), size - offset);
+    if (esp_partition_read(running, offset, buf, n) != ESP_OK) {
+      mbedtls_sha256_free(&ctx);
+      return false;
+    }
+    mbedtls_sha256_update_ret(&ctx, buf, n);
+  }
+  mbedtls_sha256_finish_ret(&ctx, sha256);
+  mbedtls_sha256_free(&ctx);
+  return memcmp(sha256, summary + 4, sizeof(sha256)) == 0;
+}
+
+
+void AsvinPeerCache::handleRequest(void) {
+  String uri = _server.uri();
+  uint8_t want[CAR_STREAM_MAX_CID];
+  uint8_t wantLen;
+  if (!_serving || !uri.startsWith("/ipfs/") || !cidFromString(uri.substring(6), want, wantLen)) {
+    _server.send(404, "text/plain", "");
+    return;
+  }
+
+  if (_server.arg("format") == "raw") {
+    if (!sendBlock(want, wantLen)) {
+      _server.send(404, "text/plain", "");
+    }
+    return;
+  }
+
+  uint8_t root[CAR_STREAM_MAX_CID];
+  uint8_t rootLen;
+  if (!cidFromString(cid(), root, rootLen) || !sameCid(want, wantLen, root, rootLen)) {
+    _server.send(404, "text/plain", "");
+    return;
+  }
+  sendCar();
+}
+
+
+void AsvinPeerCache::sendCar(void) {
+  uint8_t root[CAR_STREAM_MAX_CID];
+  uint8_t rootLen;
+  cidFromString(cid(), root, rootLen);
+
+  // dag-cbor { "roots": [ CID(root) ], "version": 1 }
+  uint8_t header[64];
+  size_t headerLen = 0;
+  const uint8_t roots[] = { 0xa2, 0x65, 'r', 'o', 'o', 't', 's', 0x81, 0xd8, 0x2a, 0x58 };
+  memcpy(header, roots, sizeof(roots));
+  headerLen = sizeof(roots);
+  header[headerLen++] = rootLen + 1;
+  header[headerLen++] = 0x00;
+  memcpy(header + headerLen, root, rootLen);
+  headerLen += rootLen;
+  const uint8_t version[] = { 0x67, 'v', 'e', 'r', 's', 'i', 'o', 'n', 0x01 };
+  memcpy(header + headerLen, version, sizeof(version));
+  headerLen += sizeof(version);
+
+  uint8_t varint[10];
+  size_t total = putVarint(varint, headerLen) + headerLen;
+  for (size_t pos = _entriesOffset; pos < _manifestLen;) {
+    uint8_t cidLen = _manifest[pos + 1];
+    uint32_t blockLen = getU32(_manifest + pos + 2 + cidLen);
+    total += putVarint(varint, cidLen + blockLen) + cidLen + blockLen;
+    pos += 2 + cidLen + 8 + (_manifest[pos] ? 0 : blockLen);
+  }
+
+  _server.setContentLength(total);
+  _server.send(200, "application/vnd.ipld.car", "");
+  WiFiClient client = _server.client();
+  client.write(varint, putVarint(varint, headerLen));
+  client.write(header, headerLen);
+
+  uint32_t offset = 0;
+  for (size_t pos = _entriesOffset; pos < _manifestLen && client.connected();) {
+    bool raw = _manifest[pos];
+    uint8_t cidLen = _manifest[pos + 1];
+    const uint8_t* blockCid = _manifest + pos + 2;
+    uint32_t blockLen = getU32(blockCid + cidLen);
+    uint32_t dataLen = getU32(blockCid + cidLen + 4);
+    const uint8_t* block = blockCid + cidLen + 8;
+
+    client.write(varint, putVarint(varint, cidLen + blockLen));
+    client.write(blockCid, cidLen);
+    if (raw) {
+      sendLeaf(client, offset, blockLen);
+    } else {
+      client.write(block, blockLen);
+    }
+    offset += dataLen;
+    pos += 2 + cidLen + 8 + (raw ? 0 : blockLen);
+  }
+}
+
+
+bool AsvinPeerCache::sendBlock(const uint8_t* want, uint8_t wantLen) {
+  uint32_t offset = 0;
+  for (size_t pos = _entriesOffset; pos < _manifestLen;) {
+    bool raw = _manifest[pos];
+    uint8_t cidLen = _manifest[pos + 1];
+    const uint8_t* blockCid = _manifest + pos + 2;
+    uint32_t blockLen = getU32(blockCid + cidLen);
+    uint32_t dataLen = getU32(blockCid + cidLen + 4);
+
+    if (sameCid(want, wantLen, blockCid, cidLen)) {
+      _server.setContentLength(blockLen);
+      _server.send(200, "application/vnd.ipld.raw", "");
+      WiFiClient client = _server.client();
+      if (raw) {
+        sendLeaf(client, offset, blockLen);
+      } else {
+        client.write(blockCid + cidLen + 8, blockLen);
+      }
+      return true;
+    }
+    offset += dataLen;
+    pos += 2 + cidLen + 8 + (raw ? 0 : blockLen);
+  }
+  return false;
+}
+
+
+bool AsvinPeerCache::sendLeaf(WiFiClient& client, uint32_t offset, uint32_t len) {
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  uint8_t buf[1024];
+  while (len > 0) {
+    uint32_t n = min((uint32_t)sizeof(buf), len);
+    if (esp_partition_read(running, offset, buf, n) != ESP_OK || client.write(buf, n) != n) {
+      return false;
+    }
+    offset += n;
+    len -= n;
+  }
+  return true;
+}
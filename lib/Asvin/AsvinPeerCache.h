@@ -0,0 +1,73 @@
+/**
+ * AsvinPeerCache.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_PEER_CACHE_H_
+#define ASVIN_PEER_CACHE_H_
+
+#include <Arduino.h>
+#include <WebServer.h>
+#include <mbedtls/sha256.h>
+#include "HTTPUpdate.h"
+
+#define ASVIN_PEER_PORT           8266
+#define ASVIN_PEER_SERVICE        "asvin-ota"
+#define ASVIN_PEER_MAX_PEERS      4
+#define ASVIN_PEER_MANIFEST_MAX   4000
+
+/*
+ * LAN cache for firmware installed by CID
+ *
+ * While an image is installed through updateFromCar, the DAG layout is
+ * recorded (CIDs of all blocks, bytes of the inner nodes). Once that image
+ * runs, the device serves it back as a CAR on /ipfs/<cid> and single blocks
+ * on /ipfs/<cid>?format=raw, reading the leaf data from the running
+ * partition, and announces the CID over mDNS. Downloaders try these peers
+ * before the WAN gateway and verify every block against the CID exactly
+ * like a gateway download.
+ */
+class AsvinPeerCache
+{
+public:
+  AsvinPeerCache(uint16_t port = ASVIN_PEER_PORT);
+  ~AsvinPeerCache(void);
+
+  // start mDNS and the HTTP server, serving the running image if its manifest checks out
+  bool begin(const char* hostname);
+  void handleClient(void);
+
+  // install cid from LAN peers, falling back to the gateway; records the manifest for serving
+  t_httpUpdate_return download(const String& cid, const String& gateway, const String& currentVersion = "");
+
+  // CID of the image this device serves, empty if none
+  String cid(void) const;
+
+private:
+  void reset(void);
+  void record(const uint8_t* cid, uint8_t cidLen, const uint8_t* block, size_t blockLen, bool raw,
+              const uint8_t* data, size_t dataLen);
+  bool commit(void);
+  bool load(void);
+  void handleRequest(void);
+  void sendCar(void);
+  bool sendBlock(const uint8_t* cid, uint8_t cidLen);
+  bool sendLeaf(WiFiClient& client, uint32_t offset, uint32_t len);
+  bool append(const void* data, size_t len);
+
+  WebServer _server;
+  uint16_t _port;
+  bool _serving;
+
+  // manifest: version, root CID, image size, image SHA-256, then per block
+  // { raw, CID, block length, data length, node bytes (inner nodes only) }
+  uint8_t* _manifest;
+  size_t _manifestLen;
+  size_t _entriesOffset;
+
+  bool _recordOverflow;
+  uint32_t _recordSize;
+  mbedtls_sha256_context _recordSha;
+};
+
+#endif
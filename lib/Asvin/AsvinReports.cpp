@@ -0,0 +1,143 @@
+/**
+ * AsvinReports.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinReports.h"
+#include <Preferences.h>
+
+#define REPORTS_NAMESPACE   "asvinReports"
+
+static String slotKey(uint8_t slot) {
+  return String("r") + slot;
+}
+
+
+AsvinReports::AsvinReports(void)
+  : _loaded(false), _head(0), _count(0) {
+}
+
+void AsvinReports::load(void) {
+  if (_loaded) {
+    return;
+  }
+  Preferences prefs;
+  // read-only begin fails until the first report was stored, the queue is empty then
+  if (prefs.begin(REPORTS_NAMESPACE, true)) {
+    _head = prefs.getUChar("head", 0) % ASVIN_REPORT_QUEUE_SIZE;
+    _count = prefs.getUChar("count", 0);
+    if (_count > ASVIN_REPORT_QUEUE_SIZE) {
+      _count = 0;
+    }
+    prefs.end();
+  }
+  _loaded = true;
+}
+
+void AsvinReports::store(void) {
+  Preferences prefs;
+  if (!prefs.begin(REPORTS_NAMESPACE, false)) {
+    return;
+  }
+  prefs.putUChar("head", _head);
+  prefs.putUChar("count", _count);
+  prefs.end();
+}
+
+bool AsvinReports::push(const asvin_report_t& report) {
+  load();
+  if (_count == ASVIN_REPORT_QUEUE_SIZE) {
+    log_w("[asvin reports] queue full, dropping the oldest report\n");
+    _head = (_head + 1) % ASVIN_REPORT_QUEUE_SIZE;
+    _count--;
+  }
+  Preferences prefs;
+  if (!prefs.begin(REPORTS_NAMESPACE, false)) {
+    return false;
+  }
+  uint8_t slot = (_head + _count) % ASVIN_REPORT_QUEUE_SIZE;
+  bool ok = prefs.putBytes(slotKey(slot).c_str(), &report, sizeof(report)) == sizeof(report);
+  prefs.end();
+  if (ok) {
+    _count++;
+  }
+  store();
+  return ok;
+}
+
+bool AsvinReports::peek(asvin_report_t& report) {
+  return get(0, report);
+}
+
+void AsvinReports::pop(void) {
+  remove(0);
+}
+
+bool AsvinReports::get(size_t index, asvin_report_t& report) {
+  load();
+  while (index < _count) {
+    Preferences prefs;
+    if (!prefs.begin(REPORTS_NAMESPACE, true)) {
+      return false;
+    }
+    size_t len = prefs.getBytes(slotKey((_head + index) % ASVIN_REPORT_QUEUE_SIZE).c_str(), &report, sizeof(report));
+    prefs.end();
+    if (len == sizeof(report)) {
+      report.rolloutID[sizeof(report.rolloutID) - 1] = 0;
+      report.version[sizeof(report.version) - 1] = 0;
+      report.tag[sizeof(report.tag) - 1] = 0;
+      return true;
+    }
+    // a record from an older layout or a torn write, skip it
+    remove(index);
+  }
+  return false;
+}
+
+void AsvinReports::remove(size_t index) {
+  load();
+  if (index >= _count) {
+    return;
+  }
+  if (index > 0) {
+    // close the gap, the newer reports move one slot towards the head
+    Preferences prefs;
+    if (!prefs.begin(REPORTS_NAMESPACE, false)) {
+      return;
+    }
+    asvin_report_t report;
+    for (size_t i = index; i + 1 < _count; i++) {
+      String from = slotKey((_head + i + 1) % ASVIN_REPORT_QUEUE_SIZE);
+      String to = slotKey((_head + i) % ASVIN_REPORT_QUEUE_SIZE);
+      if (prefs.getBytes(from.c_str(), &report, sizeof(report)) == sizeof(report)) {
+        prefs.putBytes(to.c_str(), &report, sizeof(report));
+      } else {
+        prefs.remove(to.c_str());
+      }
+    }
+    prefs.end();
+  } else {
+    _head = (_head + 1) % ASVIN_REPORT_QUEUE_SIZE;
+  }
+  _count--;
+  store();
+}
+
+bool AsvinReports::contains(const char* rolloutID) {
+  asvin_report_t report;
+  for (size_t index = 0; get(index, report); index++) {
+    if (strncmp(report.rolloutID, rolloutID, sizeof(report.rolloutID) - 1) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t AsvinReports::pending(void) {
+  load();
+  return _count;
+}
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_ASVINREPORTS)
+AsvinReports asvinReports;
+#endif
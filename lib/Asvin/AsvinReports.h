@@ -0,0 +1,61 @@
+/**
+ * AsvinReports.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_REPORTS_H_
+#define ASVIN_REPORTS_H_
+
+#include <Arduino.h>
+
+#define ASVIN_REPORT_QUEUE_SIZE   8
+
+typedef struct {
+  char rolloutID[64];
+  char version[24];
+  int32_t result;         // t_httpUpdate_return, only HTTP_UPDATE_OK reports are sent
+  uint32_t stageTime;     // ms from download start until the image was in flash
+  uint32_t startupTime;   // ms from boot to the first request
+  char tag[64];           // entity tag of a staged image, the report waits until it runs
+} asvin_report_t;
+
+/*
+ * rollout reports that could not be delivered yet
+ *
+ * A ring of ASVIN_REPORT_QUEUE_SIZE records in NVS, so a report survives
+ * reboots, deep sleep and the activation of the image it reports. When
+ * it is full, the oldest report is dropped. Asvin sends the pending
+ * reports over a connection to app.vc that is already open, one request
+ * each, and removes a report only when the server took it. A success
+ * report whose image is still staged is skipped until that image runs.
+ */
+class AsvinReports
+{
+public:
+  AsvinReports(void);
+
+  bool push(const asvin_report_t& report);
+  // oldest pending report
+  bool peek(asvin_report_t& report);
+  void pop(void);
+  // pending report at index, 0 is the oldest
+  bool get(size_t index, asvin_report_t& report);
+  void remove(size_t index);
+  // a report for this rollout is pending
+  bool contains(const char* rolloutID);
+  size_t pending(void);
+
+private:
+  void load(void);
+  void store(void);
+
+  bool _loaded;
+  uint8_t _head;
+  uint8_t _count;
+};
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_ASVINREPORTS)
+extern AsvinReports asvinReports;
+#endif
+
+#endif
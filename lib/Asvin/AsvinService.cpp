@@ -0,0 +1,235 @@
+/**
+ * AsvinService.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinService.h"
+#include "Asvin.h"
+#include <WiFi.h>
+
+
+AsvinService::AsvinService(void)
+  : _core(ASVIN_SERVICE_CORE), _priority(ASVIN_SERVICE_PRIORITY), _stackSize(ASVIN_SERVICE_STACK),
+    _registered(false), _commands(NULL), _status(NULL), _task(NULL) {
+}
+
+AsvinService::~AsvinService(void) {
+  end();
+}
+
+void AsvinService::setCore(BaseType_t core) {
+  _core = core;
+}
+
+void AsvinService::setPriority(UBaseType_t priority) {
+  _priority = priority;
+}
+
+void AsvinService::setStackSize(uint32_t bytes) {
+  _stackSize = bytes;
+}
+
+bool AsvinService::begin(const String& deviceName, const String& deviceKey, const String& customerKey, const String& firmwareVersion) {
+  if (_task) {
+    return false;
+  }
+  _deviceName = deviceName;
+  _deviceKey = deviceKey;
+  _firmwareVersion = firmwareVersion;
+  _signer.begin(customerKey);
+
+  if (!_commands) {
+    _commands = xQueueCreate(ASVIN_SERVICE_QUEUE_LENGTH, sizeof(AsvinServiceCommand));
+  }
+  if (!_status) {
+    _status = xQueueCreate(ASVIN_SERVICE_QUEUE_LENGTH, sizeof(asvin_status_t));
+  }
+  if (!_commands || !_status) {
+    log_e("[asvin service] out of memory\n");
+    return false;
+  }
+  TaskHandle_t handle;
+  if (xTaskCreatePinnedToCore(task, "asvin", _stackSize, this, _priority, &handle, _core) != pdPASS) {
+    log_e("[asvin service] creating task failed\n");
+    return false;
+  }
+  _task = handle;
+  return true;
+}
+
+bool AsvinService::end(uint32_t timeout) {
+  if (!_task) {
+    return true;
+  }
+  AsvinServiceCommand stop = ASVIN_SERVICE_STOP;
+  if (xQueueSendToFront(_commands, &stop, pdMS_TO_TICKS(timeout)) != pdPASS) {
+    return false;
+  }
+  unsigned long start = millis();
+  while (_task && millis() - start < timeout) {
+    delay(10);
+  }
+  return _task == NULL;
+}
+
+bool AsvinService::send(AsvinServiceCommand command) {
+  if (!_task) {
+    return false;
+  }
+  return xQueueSend(_commands, &command, 0) == pdPASS;
+}
+
+bool AsvinService::status(asvin_status_t& status, TickType_t wait) {
+  if (!_status) {
+    return false;
+  }
+  return xQueueReceive(_status, &status, wait) == pdPASS;
+}
+
+void AsvinService::post(AsvinServiceEvent event, int code) {
+  asvin_status_t status = { event, code };
+  // an application that does not read keeps only the latest events
+  if (xQueueSend(_status, &status, 0) != pdPASS) {
+    asvin_status_t dropped;
+    xQueueReceive(_status, &dropped, 0);
+    xQueueSend(_status, &status, 0);
+  }
+}
+
+void AsvinService::task(void* arg) {
+  AsvinService* self = (AsvinService*)arg;
+  self->post(ASVIN_SERVICE_STARTED);
+  if (httpUpdate.hasStagedUpdate()) {
+    self->post(ASVIN_SERVICE_STAGED);
+  }
+  AsvinServiceCommand command;
+  while (xQueueReceive(self->_commands, &command, portMAX_DELAY) == pdPASS) {
+    if (command == ASVIN_SERVICE_STOP) {
+      break;
+    }
+    if (command == ASVIN_SERVICE_CHECK) {
+      self->runCheck();
+    } else if (command == ASVIN_SERVICE_ACTIVATE) {
+      // only returns if the activation failed
+      httpUpdate.activateUpdate();
+      self->post(ASVIN_SERVICE_ACTIVATE_FAILED, httpUpdate.getLastError());
+    }
+  }
+  self->post(ASVIN_SERVICE_STOPPED);
+  self->_task = NULL;
+  vTaskDelete(NULL);
+}
+
+void AsvinService::runCheck(void) {
+  // the server offers the staged image again until it runs, nothing to download or report
+  if (httpUpdate.hasStagedUpdate()) {
+    post(ASVIN_SERVICE_STAGED);
+    return;
+  }
+  if (WiFi.status() != WL_CONNECTED) {
+    post(ASVIN_SERVICE_NO_WIFI);
+    return;
+  }
+  Asvin asvin;
+  int httpCode = 0;
+  if (!asvinClock.valid() && !asvin.fetchServerTime()) {
+    post(ASVIN_SERVICE_NO_TIME);
+    return;
+  }
+
+  unsigned long timestamp = asvinClock.now();
+  String response = asvin.authLogin(_deviceKey, _signer.sign(timestamp, _deviceKey), timestamp, httpCode);
+  DynamicJsonDocument doc(1000);
+  if (deserializeJson(doc, response) || !doc["token"]) {
+    post(ASVIN_SERVICE_LOGIN_FAILED, httpCode);
+    return;
+  }
+  String token = doc["token"].as<String>();
+
+  String mac = WiFi.macAddress();
+  if (!_registered) {
+    asvin.registerDevice(_deviceName, mac, _firmwareVersion, token, httpCode);
+    if (httpCode != 200) {
+      post(ASVIN_SERVICE_REGISTER_FAILED, httpCode);
+      return;
+    }
+    _registered = true;
+  }
+
+  response = asvin.checkRollout(mac, _firmwareVersion, token, httpCode);
+  if (httpCode != 200 || deserializeJson(doc, response)) {
+    post(ASVIN_SERVICE_CHECK_FAILED, httpCode);
+    return;
+  }
+  String firmwareID = doc["firmware_id"];
+  String rolloutID = doc["rollout_id"];
+  if (rolloutID == "null") {
+    post(ASVIN_SERVICE_NO_ROLLOUT);
+    return;
+  }
+  uint32_t wait = asvin.rolloutSlotDelay(response, mac);
+  if (wait) {
+    post(ASVIN_SERVICE_WAITING, wait);
+    return;
+  }
+
+  response = asvin.getBlockchainCID(firmwareID, token, httpCode);
+  if (httpCode != 200 || deserializeJson(doc, response) || !doc["cid"]) {
+    post(ASVIN_SERVICE_CID_FAILED, httpCode);
+    return;
+  }
+  String cid = doc["cid"];
+
+  post(ASVIN_SERVICE_DOWNLOADING);
+  t_httpUpdate_return ret = asvin.downloadFirmware(token, cid);
+  if (ret == HTTP_UPDATE_FAILED) {
+    post(ASVIN_SERVICE_UPDATE_FAILED, httpUpdate.getLastError());
+    return;
+  }
+  post(ret == HTTP_UPDATE_OK ? ASVIN_SERVICE_INSTALLED : ASVIN_SERVICE_UP_TO_DATE,
+       ret == HTTP_UPDATE_OK ? httpUpdate.getStageTime() : 0);
+
+  if (!asvin.reportRollout(mac, _firmwareVersion, token, rolloutID, ret, httpCode, cid)) {
+    post(ASVIN_SERVICE_REPORT_FAILED, httpCode);
+  }
+}
+
+const char* AsvinService::eventName(AsvinServiceEvent event) {
+  switch (event) {
+  case ASVIN_SERVICE_STARTED:
+    return "started";
+  case ASVIN_SERVICE_NO_WIFI:
+    return "no WiFi";
+  case ASVIN_SERVICE_NO_TIME:
+    return "no time";
+  case ASVIN_SERVICE_LOGIN_FAILED:
+    return "login failed";
+  case ASVIN_SERVICE_REGISTER_FAILED:
+    return "registration failed";
+  case ASVIN_SERVICE_CHECK_FAILED:
+    return "rollout check failed";
+  case ASVIN_SERVICE_NO_ROLLOUT:
+    return "no rollout";
+  case ASVIN_SERVICE_WAITING:
+    return "waiting for slot";
+  case ASVIN_SERVICE_CID_FAILED:
+    return "CID lookup failed";
+  case ASVIN_SERVICE_DOWNLOADING:
+    return "downloading";
+  case ASVIN_SERVICE_UPDATE_FAILED:
+    return "update failed";
+  case ASVIN_SERVICE_UP_TO_DATE:
+    return "up to date";
+  case ASVIN_SERVICE_INSTALLED:
+    return "installed";
+  case ASVIN_SERVICE_STAGED:
+    return "update staged";
+  case ASVIN_SERVICE_REPORT_FAILED:
+    return "report failed";
+  case ASVIN_SERVICE_ACTIVATE_FAILED:
+    return "activation failed";
+  case ASVIN_SERVICE_STOPPED:
+    return "stopped";
+  }
+  return "unknown";
+}
@@ -0,0 +1,117 @@
+/**
+ * AsvinService.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_SERVICE_H_
+#define ASVIN_SERVICE_H_
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "AsvinSigner.h"
+
+// loopTask runs on CONFIG_ARDUINO_RUNNING_CORE (1), the WiFi stack on core 0
+#define ASVIN_SERVICE_CORE          0
+#define ASVIN_SERVICE_PRIORITY      (tskIDLE_PRIORITY + 1)
+// TLS handshake, JSON documents and the update stream stages
+#define ASVIN_SERVICE_STACK         12288
+#define ASVIN_SERVICE_QUEUE_LENGTH  8
+
+enum AsvinServiceCommand {
+  ASVIN_SERVICE_CHECK,      // login, check for a rollout and install it
+  ASVIN_SERVICE_ACTIVATE,   // boot a staged update
+  ASVIN_SERVICE_STOP
+};
+
+enum AsvinServiceEvent {
+  ASVIN_SERVICE_STARTED,
+  ASVIN_SERVICE_NO_WIFI,
+  ASVIN_SERVICE_NO_TIME,            // neither SNTP nor the server Date gave a time
+  ASVIN_SERVICE_LOGIN_FAILED,       // code: HTTP status
+  ASVIN_SERVICE_REGISTER_FAILED,    // code: HTTP status
+  ASVIN_SERVICE_CHECK_FAILED,       // code: HTTP status
+  ASVIN_SERVICE_NO_ROLLOUT,
+  ASVIN_SERVICE_WAITING,            // code: seconds until the download slot, check again later
+  ASVIN_SERVICE_CID_FAILED,         // code: HTTP status
+  ASVIN_SERVICE_DOWNLOADING,
+  ASVIN_SERVICE_UPDATE_FAILED,      // code: httpUpdate.getLastError()
+  ASVIN_SERVICE_UP_TO_DATE,         // image already installed, reported as success
+  ASVIN_SERVICE_INSTALLED,          // code: ms until the image was in flash
+  ASVIN_SERVICE_STAGED,             // an image from before a reboot waits for activate(), checks are skipped
+  ASVIN_SERVICE_REPORT_FAILED,      // code: HTTP status, the report stays queued
+  ASVIN_SERVICE_ACTIVATE_FAILED,    // code: httpUpdate.getLastError()
+  ASVIN_SERVICE_STOPPED
+};
+
+typedef struct {
+  AsvinServiceEvent event;
+  int code;
+} asvin_status_t;
+
+/*
+ * rollout checks and updates in a FreeRTOS task of their own
+ *
+ * The application sends commands and reads status events through two
+ * queues, so TLS, JSON and flash work never block loop(). The task is
+ * pinned to a core (the one loop() does not run on by default). While it
+ * runs, the application must leave httpUpdate alone, except for settings
+ * made before begin() such as setStageOnly(). Flash writes still stall
+ * both cores briefly, the SPI flash cache is shared.
+ */
+class AsvinService
+{
+public:
+  AsvinService(void);
+  ~AsvinService(void);
+
+  // task placement, before begin()
+  void setCore(BaseType_t core);
+  void setPriority(UBaseType_t priority);
+  void setStackSize(uint32_t bytes);
+
+  bool begin(const String& deviceName, const String& deviceKey, const String& customerKey, const String& firmwareVersion);
+  // stops the task after the command in progress, waits up to timeout ms
+  bool end(uint32_t timeout = 60000);
+  bool running(void)
+  {
+    return _task != NULL;
+  }
+
+  // false if the queue is full or the service is not running
+  bool send(AsvinServiceCommand command);
+  bool check(void)
+  {
+    return send(ASVIN_SERVICE_CHECK);
+  }
+  bool activate(void)
+  {
+    return send(ASVIN_SERVICE_ACTIVATE);
+  }
+
+  // next status event, waits up to wait ticks
+  bool status(asvin_status_t& status, TickType_t wait = 0);
+  static const char* eventName(AsvinServiceEvent event);
+
+private:
+  static void task(void* arg);
+  void runCheck(void);
+  void post(AsvinServiceEvent event, int code = 0);
+
+  BaseType_t _core;
+  UBaseType_t _priority;
+  uint32_t _stackSize;
+
+  String _deviceName;
+  String _deviceKey;
+  String _firmwareVersion;
+  AsvinSigner _signer;
+  bool _registered;
+
+  QueueHandle_t _commands;
+  QueueHandle_t _status;
+  volatile TaskHandle_t _task;
+};
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * AsvinSigner.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinSigner.h"
+
+#define HMAC_BLOCK_SIZE   64
+
+static const char hexDigits[] = "0123456789abcdef";
+
+
+AsvinSigner::AsvinSigner(void)
+  : _keyed(false) {
+  mbedtls_sha256_init(&_inner);
+  mbedtls_sha256_init(&_outer);
+  _signature[0] = 0;
+}
+
+AsvinSigner::~AsvinSigner(void) {
+  mbedtls_sha256_free(&_inner);
+  mbedtls_sha256_free(&_outer);
+}
+
+void AsvinSigner::begin(const uint8_t* key, size_t len) {
+  uint8_t block[HMAC_BLOCK_SIZE];
+  memset(block, 0, sizeof(block));
+  if (len > HMAC_BLOCK_SIZE) {
+    mbedtls_sha256_ret(key, len, block, 0);
+  } else {
+    memcpy(block, key, len);
+  }
+
+  // the contexts are copies, so the SHA peripheral used for the key is not held afterwards
+  mbedtls_sha256_context ctx;
+  for (int pad = 0; pad < 2; pad++) {
+    uint8_t padded[HMAC_BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(padded); i++) {
+      padded[i] = block[i] ^ (pad == 0 ? 0x36 : 0x5c);
+    }
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    mbedtls_sha256_update_ret(&ctx, padded, sizeof(padded));
+    mbedtls_sha256_clone(pad == 0 ? &_inner : &_outer, &ctx);
+    mbedtls_sha256_free(&ctx);
+    memset(padded, 0, sizeof(padded));
+  }
+  memset(block, 0, sizeof(block));
+  _keyed = true;
+}
+
+const char* AsvinSigner::sign(unsigned long timestamp, const String& deviceKey) {
+  if (!_keyed) {
+    return NULL;
+  }
+  char digits[12];
+  ultoa(timestamp, digits, 10);
+
+  mbedtls_sha256_context inner;
+  mbedtls_sha256_init(&inner);
+  mbedtls_sha256_clone(&inner, &_inner);
+  mbedtls_sha256_update_ret(&inner, (const uint8_t*)digits, strlen(digits));
+  mbedtls_sha256_update_ret(&inner, (const uint8_t*)deviceKey.c_str(), deviceKey.length());
+  return finish(&inner);
+}
+
+const char* AsvinSigner::sign(const uint8_t* msg, size_t len) {
+  if (!_keyed) {
+    return NULL;
+  }
+  mbedtls_sha256_context inner;
+  mbedtls_sha256_init(&inner);
+  mbedtls_sha256_clone(&inner, &_inner);
+  mbedtls_sha256_update_ret(&inner, msg, len);
+  return finish(&inner);
+}
+
+const char* AsvinSigner::finish(mbedtls_sha256_context* inner) {
+  uint8_t digest[32];
+  mbedtls_sha256_finish_ret(inner, digest);
+  mbedtls_sha256_free(inner);
+
+  mbedtls_sha256_context outer;
+  mbedtls_sha256_init(&outer);
+  mbedtls_sha256_clone(&outer, &_outer);
+  mbedtls_sha256_update_ret(&outer, digest, sizeof(digest));
+  mbedtls_sha256_finish_ret(&outer, digest);
+  mbedtls_sha256_free(&outer);
+
+  for (size_t i = 0; i < sizeof(digest); i++) {
+    _signature[2 * i] = hexDigits[digest[i] >> 4];
+    _signature[2 * i + 1] = hexDigits[digest[i] & 0x0f];
+  }
+  _signature[ASVIN_SIGNATURE_LEN] = 0;
+  return _signature;
+}
@@ -0,0 +1,47 @@
+/**
+ * AsvinSigner.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_SIGNER_H_
+#define ASVIN_SIGNER_H_
+
+#include <Arduino.h>
+#include <mbedtls/sha256.h>
+
+#define ASVIN_SIGNATURE_LEN   64
+
+/*
+ * HMAC-SHA256 device signatures for the asvin auth server
+ *
+ * The key is absorbed once in begin(): the hash states after the ipad and
+ * opad blocks are kept, so each signature costs two compressions fewer and
+ * needs no allocation. The hex signature is written into a buffer owned by
+ * the signer and stays valid until the next sign().
+ */
+class AsvinSigner
+{
+public:
+  AsvinSigner(void);
+  ~AsvinSigner(void);
+
+  void begin(const uint8_t* key, size_t len);
+  void begin(const String& key)
+  {
+    begin((const uint8_t*)key.c_str(), key.length());
+  }
+
+  // signature over the decimal timestamp followed by the device key, as authLogin expects it
+  const char* sign(unsigned long timestamp, const String& deviceKey);
+  const char* sign(const uint8_t* msg, size_t len);
+
+private:
+  const char* finish(mbedtls_sha256_context* inner);
+
+  mbedtls_sha256_context _inner;
+  mbedtls_sha256_context _outer;
+  bool _keyed;
+  char _signature[ASVIN_SIGNATURE_LEN + 1];
+};
+
+#endif
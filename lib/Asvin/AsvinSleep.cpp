@@ -0,0 +1,80 @@
+/**
+ * AsvinSleep.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinSleep.h"
+#include "AsvinClock.h"
+#include <WiFi.h>
+#include <esp_sleep.h>
+
+#define SLEEP_STATE_MAGIC   0x41534c50
+
+typedef struct {
+  uint32_t magic;
+  uint32_t wakeCount;
+  uint32_t awakeMs;
+  time_t tokenExpires;
+  bool registered;
+  char token[ASVIN_SLEEP_TOKEN_MAX];
+} sleep_state_t;
+
+// RTC slow memory keeps this through deep sleep, a cold boot starts it from zero
+static RTC_DATA_ATTR sleep_state_t sleepState;
+
+
+bool AsvinSleep::begin(void) {
+  bool woke = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && sleepState.magic == SLEEP_STATE_MAGIC;
+  if (!woke) {
+    memset(&sleepState, 0, sizeof(sleepState));
+    sleepState.magic = SLEEP_STATE_MAGIC;
+  }
+  sleepState.wakeCount++;
+  return woke;
+}
+
+String AsvinSleep::token(void) {
+  time_t now = asvinClock.now();
+  if (!now || now >= sleepState.tokenExpires) {
+    return String();
+  }
+  return String(sleepState.token);
+}
+
+void AsvinSleep::setToken(const String& token, uint32_t lifetime) {
+  time_t now = asvinClock.now();
+  if (!now || token.length() == 0 || token.length() >= sizeof(sleepState.token)) {
+    sleepState.token[0] = 0;
+    sleepState.tokenExpires = 0;
+    return;
+  }
+  strcpy(sleepState.token, token.c_str());
+  // a minute early, so a token never runs out in the middle of a cycle; short lived ones at half time
+  uint32_t margin = (lifetime > 120) ? 60 : lifetime / 2;
+  sleepState.tokenExpires = now + (lifetime - margin);
+}
+
+bool AsvinSleep::registered(void) {
+  return sleepState.registered;
+}
+
+void AsvinSleep::setRegistered(bool registered) {
+  sleepState.registered = registered;
+}
+
+uint32_t AsvinSleep::lastAwakeTime(void) {
+  return sleepState.awakeMs;
+}
+
+uint32_t AsvinSleep::wakeCount(void) {
+  return sleepState.wakeCount;
+}
+
+void AsvinSleep::sleep(uint32_t seconds) {
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  esp_sleep_enable_timer_wakeup((uint64_t)seconds * 1000000ULL);
+  // millis() counts from this wake-up, the boot ROM time before it is not included
+  sleepState.awakeMs = millis();
+  esp_deep_sleep_start();
+}
@@ -0,0 +1,45 @@
+/**
+ * AsvinSleep.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_SLEEP_H_
+#define ASVIN_SLEEP_H_
+
+#include <Arduino.h>
+
+#define ASVIN_SLEEP_TOKEN_MAX       1024
+// assumed lifetime of an auth token when the caller gives none
+#define ASVIN_SLEEP_TOKEN_LIFETIME  3600
+
+/*
+ * duty cycled rollout checks for battery powered devices
+ *
+ * The device wakes on the RTC timer, checks for a rollout and goes back to
+ * deep sleep. The auth token and the registration survive deep sleep in RTC
+ * slow memory, so a wake-up without a rollout costs one request. The time
+ * from wake-up to sleep is kept for the next cycle to report.
+ */
+class AsvinSleep
+{
+public:
+  // call first in setup(), true if the device woke from deep sleep with valid state
+  static bool begin(void);
+
+  // cached auth token, empty if there is none or it expired (or the clock is unknown);
+  // setting an empty token drops the cached one
+  static String token(void);
+  static void setToken(const String& token, uint32_t lifetime = ASVIN_SLEEP_TOKEN_LIFETIME);
+
+  static bool registered(void);
+  static void setRegistered(bool registered);
+
+  // ms from wake-up to sleep in the previous cycle, 0 after a cold boot
+  static uint32_t lastAwakeTime(void);
+  static uint32_t wakeCount(void);
+
+  // WiFi off, arm the timer and deep sleep, does not return
+  static void sleep(uint32_t seconds);
+};
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * AsvinSlot.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinSlot.h"
+#include <string.h>
+
+uint32_t asvinSlotOffset(const char* mac, const char* rolloutID, uint32_t window) {
+  if (!window) {
+    return 0;
+  }
+  // the rollout ID gives every campaign a different order
+  uint32_t hash = 2166136261u;
+  const char* parts[] = { mac, rolloutID };
+  for (const char* part : parts) {
+    for (const char* c = part; *c; c++) {
+      hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+  }
+  return hash % window;
+}
+
+time_t asvinSlotSeen(asvin_slot_t& slot, const char* rolloutID, time_t now) {
+  // compare the stored form, a long ID must still match itself
+  if (strncmp(slot.id, rolloutID, sizeof(slot.id) - 1) != 0) {
+    strncpy(slot.id, rolloutID, sizeof(slot.id) - 1);
+    slot.id[sizeof(slot.id) - 1] = 0;
+    slot.seen = now;
+  }
+  return slot.seen;
+}
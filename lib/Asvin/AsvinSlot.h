@@ -0,0 +1,28 @@
+/**
+ * AsvinSlot.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_SLOT_H_
+#define ASVIN_SLOT_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// when this device first saw a rollout, IDs longer than the buffer are kept truncated
+typedef struct {
+  char id[64];
+  time_t seen;
+} asvin_slot_t;
+
+/*
+ * rollout slot helpers, free of the framework so the native tests build them
+ */
+
+// deterministic offset in [0, window) of a device within a rollout (FNV-1a of mac and rollout ID)
+uint32_t asvinSlotOffset(const char* mac, const char* rolloutID, uint32_t window);
+
+// when the rollout was first seen, starts at now for a rollout other than the stored one
+time_t asvinSlotSeen(asvin_slot_t& slot, const char* rolloutID, time_t now);
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * AsvinStartup.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinStartup.h"
+#include <WiFi.h>
+
+static const char* milestoneNames[ASVIN_STARTUP_MILESTONES] = {
+  "setup",
+  "wifi associated",
+  "ip acquired",
+  "time synced",
+  "tls handshake",
+  "first request"
+};
+
+// the WiFi event callbacks carry no context
+static AsvinStartup* startupInstance = NULL;
+
+static void startupWiFiEvent(system_event_id_t event) {
+  if (!startupInstance) {
+    return;
+  }
+  if (event == SYSTEM_EVENT_STA_CONNECTED) {
+    startupInstance->mark(ASVIN_STARTUP_WIFI_ASSOCIATED);
+    // a static (or reused) address raises no GOT_IP event
+    if (WiFi.localIP() != IPAddress(0u)) {
+      startupInstance->mark(ASVIN_STARTUP_IP_ACQUIRED);
+    }
+  } else if (event == SYSTEM_EVENT_STA_GOT_IP) {
+    startupInstance->mark(ASVIN_STARTUP_IP_ACQUIRED);
+  }
+}
+
+
+AsvinStartup::AsvinStartup(void) {
+  memset(&_profile, 0, sizeof(_profile));
+}
+
+void AsvinStartup::begin(void) {
+  mark(ASVIN_STARTUP_SETUP);
+  if (startupInstance) {
+    return;
+  }
+  startupInstance = this;
+  WiFi.onEvent(startupWiFiEvent, SYSTEM_EVENT_STA_CONNECTED);
+  WiFi.onEvent(startupWiFiEvent, SYSTEM_EVENT_STA_GOT_IP);
+}
+
+void AsvinStartup::mark(AsvinStartupMilestone milestone) {
+  if (milestone >= ASVIN_STARTUP_MILESTONES || _profile.at[milestone]) {
+    return;
+  }
+  // millis() is 0 only in the first ms after boot, count it as 1 to keep 0 meaning unset
+  uint32_t now = millis();
+  _profile.at[milestone] = now ? now : 1;
+}
+
+bool AsvinStartup::reached(AsvinStartupMilestone milestone) const {
+  return milestone < ASVIN_STARTUP_MILESTONES && _profile.at[milestone] != 0;
+}
+
+const asvin_startup_t& AsvinStartup::profile(void) const {
+  return _profile;
+}
+
+void AsvinStartup::print(Print& out) const {
+  uint32_t last = 0;
+  for (int i = 0; i < ASVIN_STARTUP_MILESTONES; i++) {
+    if (!_profile.at[i]) {
+      out.printf("[asvin startup] %-16s -\n", milestoneNames[i]);
+      continue;
+    }
+    out.printf("[asvin startup] %-16s %6u ms (+%u)\n", milestoneNames[i], _profile.at[i], _profile.at[i] - last);
+    last = _profile.at[i];
+  }
+}
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_ASVINSTARTUP)
+AsvinStartup asvinStartup;
+#endif
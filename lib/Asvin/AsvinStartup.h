@@ -0,0 +1,58 @@
+/**
+ * AsvinStartup.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_STARTUP_H_
+#define ASVIN_STARTUP_H_
+
+#include <Arduino.h>
+
+enum AsvinStartupMilestone {
+  ASVIN_STARTUP_SETUP = 0,
+  ASVIN_STARTUP_WIFI_ASSOCIATED,
+  ASVIN_STARTUP_IP_ACQUIRED,
+  ASVIN_STARTUP_TIME_SYNCED,
+  ASVIN_STARTUP_TLS_HANDSHAKE,
+  ASVIN_STARTUP_FIRST_REQUEST,
+  ASVIN_STARTUP_MILESTONES
+};
+
+// ms since boot at which each milestone was first reached, 0 if not yet
+typedef struct {
+  uint32_t at[ASVIN_STARTUP_MILESTONES];
+} asvin_startup_t;
+
+/*
+ * boot to first request profile
+ *
+ * begin() at the top of setup() records the setup milestone and listens
+ * for the WiFi events. The clock, the TLS client and the first request
+ * mark the rest, so nothing has to be threaded through WiFiManager or
+ * the Asvin calls. Times are from millis(), the bootloader and the
+ * image load before app start are not included.
+ */
+class AsvinStartup
+{
+public:
+  AsvinStartup(void);
+
+  void begin(void);
+
+  // keeps the first time only
+  void mark(AsvinStartupMilestone milestone);
+  bool reached(AsvinStartupMilestone milestone) const;
+  const asvin_startup_t& profile(void) const;
+
+  // one line per milestone with the time since the previous one
+  void print(Print& out) const;
+
+private:
+  asvin_startup_t _profile;
+};
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_ASVINSTARTUP)
+extern AsvinStartup asvinStartup;
+#endif
+
+#endif
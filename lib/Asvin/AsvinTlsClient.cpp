@@ -0,0 +1,412 @@
+/**
+ * AsvinTlsClient.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include "AsvinTlsClient.h"
+#include "AsvinStartup.h"
+
+#ifdef ASVIN_TLS_MFL
+
+#include <new>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+
+struct AsvinTlsState
+{
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config conf;
+  mbedtls_ctr_drbg_context drbg;
+  mbedtls_entropy_context entropy;
+  mbedtls_x509_crt ca;
+};
+
+#ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+static unsigned char fragmentLengthCode(uint16_t len) {
+  switch (len) {
+    case 512:
+      return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+    case 1024:
+      return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+    case 2048:
+      return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+    case 4096:
+      return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+    default:
+      return MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+  }
+}
+#endif
+
+// a new client is made for every call, so refusals are kept per host
+static char refusedHosts[ASVIN_TLS_REFUSED_HOSTS][64];
+static uint8_t refusedNext;
+
+static bool fragmentLengthRefused(const char* host) {
+  for (int i = 0; i < ASVIN_TLS_REFUSED_HOSTS; i++) {
+    if (strcmp(refusedHosts[i], host) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void refuseFragmentLength(const char* host) {
+  strlcpy(refusedHosts[refusedNext], host, sizeof(refusedHosts[refusedNext]));
+  refusedNext = (refusedNext + 1) % ASVIN_TLS_REFUSED_HOSTS;
+}
+
+/*
+ * only an alert that points at the extension allows a retry without it,
+ * a bad certificate or a timeout fails the same way the second time
+ */
+static bool refusedExtension(int ret, const mbedtls_ssl_context* ssl) {
+  if (ret == MBEDTLS_ERR_SSL_BAD_HS_SERVER_HELLO) {
+    return true;
+  }
+  if (ret != MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE || !ssl->in_msg) {
+    return false;
+  }
+  switch (ssl->in_msg[1]) {
+    case MBEDTLS_SSL_ALERT_MSG_ILLEGAL_PARAMETER:
+    case MBEDTLS_SSL_ALERT_MSG_DECODE_ERROR:
+    case MBEDTLS_SSL_ALERT_MSG_UNSUPPORTED_EXT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+AsvinTlsClient::AsvinTlsClient(void)
+  : _tls(NULL), _rootCA(NULL), _fragmentLength(ASVIN_TLS_FRAGMENT_LENGTH), _peeked(-1), _timing(false), _tlsMicros(0), _socketMicros(0) {
+}
+
+AsvinTlsClient::~AsvinTlsClient(void) {
+  stop();
+}
+
+void AsvinTlsClient::setCACert(const char* rootCA) {
+  _rootCA = rootCA;
+}
+
+void AsvinTlsClient::setMaxFragmentLength(uint16_t len) {
+  _fragmentLength = len;
+}
+
+size_t AsvinTlsClient::fragmentLength(void) {
+  if (!_tls) {
+    return 0;
+  }
+#ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+  return mbedtls_ssl_get_max_frag_len(&_tls->ssl);
+#else
+  return MBEDTLS_SSL_MAX_CONTENT_LEN;
+#endif
+}
+
+int AsvinTlsClient::connect(IPAddress ip, uint16_t port) {
+  return connect(ip.toString().c_str(), port);
+}
+
+int AsvinTlsClient::connect(IPAddress ip, uint16_t port, int32_t timeout) {
+  return connect(ip.toString().c_str(), port, timeout);
+}
+
+int AsvinTlsClient::connect(const char* host, uint16_t port) {
+  return connect(host, port, ASVIN_TLS_HANDSHAKE_TIMEOUT);
+}
+
+int AsvinTlsClient::connect(const char* host, uint16_t port, int32_t timeout) {
+  stop();
+  if (!WiFiClient::connect(host, port, timeout)) {
+    return 0;
+  }
+  bool offer = _fragmentLength && !fragmentLengthRefused(host);
+  bool refused = false;
+  if (handshake(host, offer, refused)) {
+    return 1;
+  }
+  if (!offer || !refused) {
+    stop();
+    return 0;
+  }
+  // some servers abort on the extension instead of ignoring it, retry once without
+  log_d("[asvin tls] %s refused max fragment length %u, retrying without\n", host, _fragmentLength);
+  refuseFragmentLength(host);
+  stop();
+  if (!WiFiClient::connect(host, port, timeout)) {
+    return 0;
+  }
+  if (!handshake(host, false, refused)) {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+bool AsvinTlsClient::handshake(const char* host, bool offerFragmentLength, bool& refused) {
+  _tls = new (std::nothrow) AsvinTlsState;
+  if (!_tls) {
+    log_e("[asvin tls] out of memory\n");
+    return false;
+  }
+  mbedtls_ssl_init(&_tls->ssl);
+  mbedtls_ssl_config_init(&_tls->conf);
+  mbedtls_ctr_drbg_init(&_tls->drbg);
+  mbedtls_entropy_init(&_tls->entropy);
+  mbedtls_x509_crt_init(&_tls->ca);
+
+  int ret = mbedtls_ctr_drbg_seed(&_tls->drbg, mbedtls_entropy_func, &_tls->entropy, NULL, 0);
+  if (ret == 0) {
+    ret = mbedtls_ssl_config_defaults(&_tls->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+  }
+  if (ret == 0 && _rootCA) {
+    ret = mbedtls_x509_crt_parse(&_tls->ca, (const unsigned char*)_rootCA, strlen(_rootCA) + 1);
+    mbedtls_ssl_conf_ca_chain(&_tls->conf, &_tls->ca, NULL);
+    mbedtls_ssl_conf_authmode(&_tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  } else {
+    mbedtls_ssl_conf_authmode(&_tls->conf, MBEDTLS_SSL_VERIFY_NONE);
+  }
+  mbedtls_ssl_conf_rng(&_tls->conf, mbedtls_ctr_drbg_random, &_tls->drbg);
+#ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+  if (ret == 0 && offerFragmentLength) {
+    ret = mbedtls_ssl_conf_max_frag_len(&_tls->conf, fragmentLengthCode(_fragmentLength));
+  }
+#endif
+  if (ret == 0) {
+    ret = mbedtls_ssl_setup(&_tls->ssl, &_tls->conf);
+  }
+  if (ret == 0) {
+    ret = mbedtls_ssl_set_hostname(&_tls->ssl, host);
+  }
+  if (ret != 0) {
+    log_e("[asvin tls] setup failed: -0x%04x\n", -ret);
+    freeTls();
+    return false;
+  }
+  mbedtls_ssl_set_bio(&_tls->ssl, this, sendCallback, recvCallback, NULL);
+
+  unsigned long start = millis();
+  while ((ret = mbedtls_ssl_handshake(&_tls->ssl)) != 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      break;
+    }
+    if (millis() - start > ASVIN_TLS_HANDSHAKE_TIMEOUT) {
+      ret = MBEDTLS_ERR_SSL_TIMEOUT;
+      break;
+    }
+    delay(1);
+  }
+  if (ret != 0) {
+    log_e("[asvin tls] handshake with %s failed: -0x%04x\n", host, -ret);
+    refused = offerFragmentLength && refusedExtension(ret, &_tls->ssl);
+    freeTls();
+    return false;
+  }
+  log_d("[asvin tls] connected to %s, fragment length %u\n", host, (unsigned)fragmentLength());
+  asvinStartup.mark(ASVIN_STARTUP_TLS_HANDSHAKE);
+  return true;
+}
+
+void AsvinTlsClient::freeTls(void) {
+  if (!_tls) {
+    return;
+  }
+  mbedtls_ssl_free(&_tls->ssl);
+  mbedtls_ssl_config_free(&_tls->conf);
+  mbedtls_ctr_drbg_free(&_tls->drbg);
+  mbedtls_entropy_free(&_tls->entropy);
+  mbedtls_x509_crt_free(&_tls->ca);
+  delete _tls;
+  _tls = NULL;
+}
+
+int AsvinTlsClient::sendCallback(void* ctx, const unsigned char* buf, size_t len) {
+  AsvinTlsClient* self = (AsvinTlsClient*)ctx;
+  size_t written = self->WiFiClient::write(buf, len);
+  if (written == 0) {
+    return self->WiFiClient::connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_SSL_CONN_EOF;
+  }
+  return written;
+}
+
+int AsvinTlsClient::recvCallback(void* ctx, unsigned char* buf, size_t len) {
+  AsvinTlsClient* self = (AsvinTlsClient*)ctx;
+  uint32_t start = micros();
+  int got = MBEDTLS_ERR_SSL_WANT_READ;
+  if (self->WiFiClient::available() > 0) {
+    got = self->WiFiClient::read(buf, len);
+    if (got <= 0) {
+      got = MBEDTLS_ERR_SSL_WANT_READ;
+    }
+  } else if (!self->WiFiClient::connected()) {
+    got = MBEDTLS_ERR_SSL_CONN_EOF;
+  }
+  // only reads made from a timed mbedtls_ssl_read count, the handshake does not
+  if (self->_timing) {
+    self->_socketMicros += micros() - start;
+  }
+  return got;
+}
+
+size_t AsvinTlsClient::write(uint8_t data) {
+  return write(&data, 1);
+}
+
+size_t AsvinTlsClient::write(const uint8_t* buf, size_t size) {
+  if (!_tls) {
+    return 0;
+  }
+  size_t done = 0;
+  unsigned long start = millis();
+  while (done < size) {
+    int ret = mbedtls_ssl_write(&_tls->ssl, buf + done, size - done);
+    if (ret > 0) {
+      asvinStartup.mark(ASVIN_STARTUP_FIRST_REQUEST);
+      done += ret;
+      start = millis();
+    } else if (ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_WANT_READ) {
+      log_e("[asvin tls] write failed: -0x%04x\n", -ret);
+      stop();
+      break;
+    } else if (millis() - start > ASVIN_TLS_HANDSHAKE_TIMEOUT) {
+      break;
+    } else {
+      delay(1);
+    }
+  }
+  return done;
+}
+
+int AsvinTlsClient::available(void) {
+  if (!_tls) {
+    return _peeked >= 0 ? 1 : 0;
+  }
+  int ready = mbedtls_ssl_get_bytes_avail(&_tls->ssl);
+  if (ready == 0) {
+    // let mbedTLS pull and decrypt the next record, if one has arrived
+    uint32_t start = micros();
+    _timing = true;
+    int ret = mbedtls_ssl_read(&_tls->ssl, NULL, 0);
+    _timing = false;
+    _tlsMicros += micros() - start;
+    ready = mbedtls_ssl_get_bytes_avail(&_tls->ssl);
+    if (ready == 0 && ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      if (ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY && ret != MBEDTLS_ERR_SSL_CONN_EOF) {
+        log_e("[asvin tls] read failed: -0x%04x\n", -ret);
+      }
+      stop();
+    }
+  }
+  return ready + (_peeked >= 0 ? 1 : 0);
+}
+
+int AsvinTlsClient::read(void) {
+  uint8_t data;
+  if (read(&data, 1) != 1) {
+    return -1;
+  }
+  return data;
+}
+
+int AsvinTlsClient::read(uint8_t* buf, size_t size) {
+  if (!size) {
+    return 0;
+  }
+  int got = 0;
+  if (_peeked >= 0) {
+    buf[got++] = _peeked;
+    _peeked = -1;
+    if (--size == 0) {
+      return got;
+    }
+  }
+  if (!_tls || !available()) {
+    return got ? got : -1;
+  }
+  uint32_t start = micros();
+  _timing = true;
+  int ret = mbedtls_ssl_read(&_tls->ssl, buf + got, size);
+  _timing = false;
+  _tlsMicros += micros() - start;
+  if (ret > 0) {
+    got += ret;
+  }
+  return got ? got : -1;
+}
+
+int AsvinTlsClient::peek(void) {
+  if (_peeked < 0) {
+    int data = read();
+    if (data < 0) {
+      return -1;
+    }
+    _peeked = data;
+  }
+  return _peeked;
+}
+
+void AsvinTlsClient::flush(void) {
+  uint8_t buf[64];
+  while (_tls && available()) {
+    read(buf, sizeof(buf));
+  }
+}
+
+void AsvinTlsClient::stop(void) {
+  if (_tls) {
+    mbedtls_ssl_close_notify(&_tls->ssl);
+    freeTls();
+  }
+  _peeked = -1;
+  WiFiClient::stop();
+}
+
+uint8_t AsvinTlsClient::connected(void) {
+  if (_peeked >= 0) {
+    return 1;
+  }
+  if (!_tls) {
+    return 0;
+  }
+  return mbedtls_ssl_get_bytes_avail(&_tls->ssl) > 0 || WiFiClient::connected();
+}
+
+#else
+
+int AsvinTlsClient::connect(IPAddress ip, uint16_t port) {
+  return connect(ip, port, ASVIN_TLS_HANDSHAKE_TIMEOUT);
+}
+
+int AsvinTlsClient::connect(IPAddress ip, uint16_t port, int32_t timeout) {
+  if (!WiFiClientSecure::connect(ip, port, timeout)) {
+    return 0;
+  }
+  asvinStartup.mark(ASVIN_STARTUP_TLS_HANDSHAKE);
+  return 1;
+}
+
+int AsvinTlsClient::connect(const char* host, uint16_t port) {
+  return connect(host, port, ASVIN_TLS_HANDSHAKE_TIMEOUT);
+}
+
+int AsvinTlsClient::connect(const char* host, uint16_t port, int32_t timeout) {
+  if (!WiFiClientSecure::connect(host, port, timeout)) {
+    return 0;
+  }
+  asvinStartup.mark(ASVIN_STARTUP_TLS_HANDSHAKE);
+  return 1;
+}
+
+size_t AsvinTlsClient::write(const uint8_t* buf, size_t size) {
+  size_t written = WiFiClientSecure::write(buf, size);
+  if (written > 0) {
+    asvinStartup.mark(ASVIN_STARTUP_FIRST_REQUEST);
+  }
+  return written;
+}
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * AsvinTlsClient.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ASVIN_TLS_CLIENT_H_
+#define ASVIN_TLS_CLIENT_H_
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+
+#define ASVIN_TLS_FRAGMENT_LENGTH     4096
+#define ASVIN_TLS_HANDSHAKE_TIMEOUT   10000
+// hosts remembered as refusing the max fragment length extension
+#define ASVIN_TLS_REFUSED_HOSTS       4
+
+#ifdef ASVIN_TLS_MFL
+
+struct AsvinTlsState;
+
+/*
+ * TLS transport for the asvin API calls (build with -DASVIN_TLS_MFL)
+ *
+ * Works like WiFiClientSecure, but asks the server for a maximum fragment
+ * length (RFC 6066) so records stay small. A server that answers the
+ * extension with a fatal alert is retried without it, and the extension
+ * is not offered to that host again for as long as the device runs. The
+ * mbedTLS state lives on the heap only while connected.
+ *
+ * The record buffers themselves are sized when the framework is built
+ * (CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN / OUT_CONTENT_LEN). The negotiated
+ * length only saves heap with a framework whose buffers were lowered to
+ * it or are allocated dynamically; the stock 1.0.x framework has neither,
+ * which is why this client is not built by default.
+ */
+class AsvinTlsClient : public WiFiClient
+{
+public:
+  AsvinTlsClient(void);
+  ~AsvinTlsClient(void);
+
+  // PEM root certificate, without one the server is not authenticated (like WiFiClientSecure)
+  void setCACert(const char* rootCA);
+  // 512, 1024, 2048 or 4096, 0 disables the extension
+  void setMaxFragmentLength(uint16_t len);
+  // fragment length in effect on the current connection
+  size_t fragmentLength(void);
+  // microseconds spent decrypting received records since the last reset; socket
+  // reads and the handshake are not counted
+  uint32_t decryptTime(void)
+  {
+    return (_tlsMicros > _socketMicros) ? _tlsMicros - _socketMicros : 0;
+  }
+  void resetTimes(void)
+  {
+    _tlsMicros = 0;
+    _socketMicros = 0;
+  }
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(IPAddress ip, uint16_t port, int32_t timeout);
+  int connect(const char* host, uint16_t port);
+  int connect(const char* host, uint16_t port, int32_t timeout);
+  size_t write(uint8_t data);
+  size_t write(const uint8_t* buf, size_t size);
+  int available(void);
+  int read(void);
+  int read(uint8_t* buf, size_t size);
+  int peek(void);
+  void flush(void);
+  void stop(void);
+  uint8_t connected(void);
+
+private:
+  bool handshake(const char* host, bool offerFragmentLength, bool& refused);
+  void freeTls(void);
+  static int sendCallback(void* ctx, const unsigned char* buf, size_t len);
+  static int recvCallback(void* ctx, unsigned char* buf, size_t len);
+
+  AsvinTlsState* _tls;
+  const char* _rootCA;
+  uint16_t _fragmentLength;
+  int _peeked;
+  bool _timing;
+  uint32_t _tlsMicros;
+  uint32_t _socketMicros;
+};
+
+#else
+
+/*
+ * TLS transport for the asvin API calls
+ *
+ * WiFiClientSecure that records the startup milestones. Fragment length
+ * and decrypt time are only available with -DASVIN_TLS_MFL, here they
+ * report 0.
+ */
+class AsvinTlsClient : public WiFiClientSecure
+{
+public:
+  using WiFiClientSecure::connect;
+  using WiFiClientSecure::write;
+
+  void setMaxFragmentLength(uint16_t len)
+  {
+  }
+  size_t fragmentLength(void)
+  {
+    return 0;
+  }
+  uint32_t decryptTime(void)
+  {
+    return 0;
+  }
+  void resetTimes(void)
+  {
+  }
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(IPAddress ip, uint16_t port, int32_t timeout);
+  int connect(const char* host, uint16_t port);
+  int connect(const char* host, uint16_t port, int32_t timeout);
+  size_t write(const uint8_t* buf, size_t size);
+};
+
+#endif
+
+#endif
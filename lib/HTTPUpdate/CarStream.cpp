@@ -0,0 +1,295 @@
+/**
+ * CarStream.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "CarStream.h"
+#include <memory>
+#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+#include <mbedtls/sha256.h>
+
+#define UNIXFS_TYPE_RAW     (0)
+#define UNIXFS_TYPE_FILE    (2)
+
+bool cidFromString(const String& text, uint8_t* bytes, uint8_t& len)
+{
+    return cidFromText(text.c_str(), bytes, len);
+}
+
+String cidToString(const uint8_t* bytes, uint8_t len)
+{
+    char text[CID_MAX_TEXT];
+    cidToText(bytes, len, text);
+    return String(text);
+}
+
+CarStream::CarStream(Stream& src, const String& gateway, size_t maxBlock)
+        : _src(src), _gateway(gateway), _maxBlock(maxBlock), _block(NULL), _stack(NULL), _depth(0),
+          _carLost(false), _blocks(0), _refetched(0)
+{
+}
+
+CarStream::~CarStream(void)
+{
+    free(_block);
+    free(_stack);
+}
+
+bool CarStream::begin(const String& root)
+{
+    _block = (uint8_t *) malloc(_maxBlock + CAR_STREAM_MAX_CID);
+    _stack = (Cid *) malloc(CAR_STREAM_MAX_LINKS * sizeof(Cid));
+    if(!_block || !_stack) {
+        log_e("no memory for block buffer\n");
+        _failed = true;
+        return false;
+    }
+
+    Cid cid;
+    if(!cidFromString(root, cid.bytes, cid.len)) {
+        log_e("unsupported root CID %s\n", root.c_str());
+        _failed = true;
+        return false;
+    }
+    push(cid.bytes, cid.len);
+
+    // the header only repeats the roots, the root CID is checked with its block
+    uint64_t headerLen;
+    if(!readVarint(headerLen) || headerLen > _maxBlock
+            || _src.readBytes((char *) _block, headerLen) != headerLen) {
+        log_w("CAR header unreadable, fetching blocks one by one\n");
+        _carLost = true;
+    }
+    return true;
+}
+
+void CarStream::decode(void)
+{
+    while(_depth > 0) {
+        Cid expected = _stack[--_depth];
+        size_t len = 0;
+        bool ok = !_carLost && readSection(expected, len);
+
+        for(int retry = 0; !ok && retry < CAR_STREAM_REFETCH_RETRIES; retry++) {
+            ok = refetch(expected, len) && verify(expected, len);
+            if(ok) {
+                _refetched++;
+            }
+        }
+        if(!ok) {
+            log_e("block %s failed verification\n", cidToString(expected.bytes, expected.len).c_str());
+            _failed = true;
+            return;
+        }
+
+        _blocks++;
+        if(!publish(expected, len)) {
+            log_e("block %u is not part of a UnixFS file\n", _blocks);
+            _failed = true;
+            return;
+        }
+        if(_onBlock) {
+            uint64_t codec;
+            const uint8_t* digest;
+            cidParse(expected.bytes, expected.len, codec, &digest);
+            _onBlock(expected.bytes, expected.len, _block, len, codec == CID_CODEC_RAW, _data, _len);
+        }
+        if(_len > 0) {
+            _finished = (_depth == 0);
+            return;
+        }
+    }
+    _finished = true;
+}
+
+bool CarStream::readSection(const Cid& expected, size_t& len)
+{
+    uint64_t sectionLen;
+    if(!readVarint(sectionLen) || sectionLen == 0 || sectionLen > _maxBlock + CAR_STREAM_MAX_CID
+            || _src.readBytes((char *) _block, sectionLen) != sectionLen) {
+        log_w("CAR section unreadable, fetching blocks one by one\n");
+        _carLost = true;
+        return false;
+    }
+
+    if(sectionLen < expected.len || memcmp(_block, expected.bytes, expected.len) != 0) {
+        log_w("CAR out of order at block %u, fetching blocks one by one\n", _blocks);
+        _carLost = true;
+        return false;
+    }
+
+    // keep the block data at the start of the buffer like a refetched block
+    len = sectionLen - expected.len;
+    memmove(_block, _block + expected.len, len);
+    if(!verify(expected, len)) {
+        log_w("block %u corrupt, fetching it again\n", _blocks);
+        return false;
+    }
+    return true;
+}
+
+bool CarStream::refetch(const Cid& cid, size_t& len)
+{
+    String url = _gateway + cidToString(cid.bytes, cid.len) + "?format=raw";
+    std::unique_ptr<WiFiClient> client(_gateway.startsWith("https") ? new WiFiClientSecure : new WiFiClient);
+    HTTPClient http;
+    if(!http.begin(*client, url)) {
+        return false;
+    }
+    http.useHTTP10(true);
+    http.setUserAgent("ESP32-http-Update");
+    http.addHeader("Accept", "application/vnd.ipld.raw");
+
+    int code = http.GET();
+    int size = http.getSize();
+    if(code != HTTP_CODE_OK || size <= 0 || (size_t) size > _maxBlock) {
+        log_e("block fetch %s failed (%d, %d bytes)\n", url.c_str(), code, size);
+        http.end();
+        return false;
+    }
+    len = http.getStreamPtr()->readBytes((char *) _block, size);
+    http.end();
+    return len == (size_t) size;
+}
+
+bool CarStream::verify(const Cid& cid, size_t len)
+{
+    uint64_t codec;
+    const uint8_t* digest;
+    if(cidParse(cid.bytes, cid.len, codec, &digest) == 0) {
+        return false;
+    }
+
+    uint8_t sha256[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    mbedtls_sha256_update_ret(&ctx, _block, len);
+    mbedtls_sha256_finish_ret(&ctx, sha256);
+    mbedtls_sha256_free(&ctx);
+    return memcmp(sha256, digest, sizeof(sha256)) == 0;
+}
+
+bool CarStream::publish(const Cid& cid, size_t len)
+{
+    uint64_t codec;
+    const uint8_t* digest;
+    cidParse(cid.bytes, cid.len, codec, &digest);
+
+    if(codec == CID_CODEC_RAW) {
+        _data = _block;
+        _len = len;
+        return true;
+    }
+    if(codec != CID_CODEC_DAG_PB) {
+        return false;
+    }
+
+    // PBNode { repeated PBLink Links = 2; bytes Data = 1; }, PBLink { bytes Hash = 1; ... }
+    const uint8_t* p = _block;
+    const uint8_t* unixfs = NULL;
+    size_t unixfsLen = 0;
+    size_t base = _depth;
+    size_t pos = 0;
+    while(pos < len) {
+        uint64_t key, fieldLen;
+        if(!cidVarint(p, len, pos, key)) {
+            return false;
+        }
+        if((key & 7) != 2) {
+            return false;
+        }
+        if(!cidVarint(p, len, pos, fieldLen) || pos + fieldLen > len) {
+            return false;
+        }
+        if((key >> 3) == 2) {
+            const uint8_t* link = p + pos;
+            size_t linkPos = 0;
+            while(linkPos < fieldLen) {
+                uint64_t linkKey, value;
+                if(!cidVarint(link, fieldLen, linkPos, linkKey) || !cidVarint(link, fieldLen, linkPos, value)) {
+                    return false;
+                }
+                if((linkKey & 7) == 0) {
+                    continue;
+                }
+                if((linkKey & 7) != 2 || linkPos + value > fieldLen) {
+                    return false;
+                }
+                if((linkKey >> 3) == 1 && !push(link + linkPos, value)) {
+                    return false;
+                }
+                linkPos += value;
+            }
+        } else if((key >> 3) == 1) {
+            unixfs = p + pos;
+            unixfsLen = fieldLen;
+        }
+        pos += fieldLen;
+    }
+
+    // links come out of the CAR in order, so the first one has to be on top
+    for(size_t i = base, j = _depth; i + 1 < j; i++, j--) {
+        Cid tmp = _stack[i];
+        _stack[i] = _stack[j - 1];
+        _stack[j - 1] = tmp;
+    }
+
+    // UnixFS Data { Type Type = 1; bytes Data = 2; ... }
+    uint64_t type = UINT64_MAX;
+    _data = NULL;
+    _len = 0;
+    pos = 0;
+    while(unixfs && pos < unixfsLen) {
+        uint64_t key, value;
+        if(!cidVarint(unixfs, unixfsLen, pos, key) || !cidVarint(unixfs, unixfsLen, pos, value)) {
+            return false;
+        }
+        if((key & 7) == 0) {
+            if((key >> 3) == 1) {
+                type = value;
+            }
+            continue;
+        }
+        if((key & 7) != 2 || pos + value > unixfsLen) {
+            return false;
+        }
+        if((key >> 3) == 2) {
+            _data = unixfs + pos;
+            _len = value;
+        }
+        pos += value;
+    }
+    return type == UNIXFS_TYPE_FILE || type == UNIXFS_TYPE_RAW;
+}
+
+bool CarStream::push(const uint8_t* bytes, size_t len)
+{
+    uint64_t codec;
+    const uint8_t* digest;
+    if(_depth >= CAR_STREAM_MAX_LINKS || len > CAR_STREAM_MAX_CID || cidParse(bytes, len, codec, &digest) != len) {
+        return false;
+    }
+    _stack[_depth].len = len;
+    memcpy(_stack[_depth].bytes, bytes, len);
+    _depth++;
+    return true;
+}
+
+bool CarStream::readVarint(uint64_t& value)
+{
+    value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        uint8_t b;
+        if(_src.readBytes((char *) &b, 1) != 1) {
+            return false;
+        }
+        value |= (uint64_t) (b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,93 @@
+/**
+ * CarStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___CAR_STREAM_H___
+#define ___CAR_STREAM_H___
+
+#include <functional>
+#include "DecodeStream.h"
+#include "Cid.h"
+
+#define CAR_STREAM_MAX_BLOCK        (64 * 1024)
+#define CAR_STREAM_MAX_LINKS        (256)
+#define CAR_STREAM_MAX_CID          CID_MAX_BYTES
+#define CAR_STREAM_REFETCH_RETRIES  (2)
+
+/// called for every verified block, data is the part of the block that belongs to the image
+typedef std::function<void(const uint8_t* cid, uint8_t cidLen, const uint8_t* block, size_t blockLen, bool raw,
+                           const uint8_t* data, size_t dataLen)> CarBlockCallback;
+
+/**
+ * walks a UnixFS file DAG delivered as a CAR v1 stream (depth first, with
+ * duplicates) and hands out the file bytes
+ *
+ * every block is checked against the sha2-256 multihash of the CID its
+ * parent links to, starting with the root CID. A block that fails the check
+ * is fetched again on its own from the gateway ("?format=raw"); if the CAR
+ * stream itself loses sync, all remaining blocks are fetched that way.
+ *
+ * blocks are buffered before they are handed out, so the image must be
+ * chunked with blocks of at most maxBlock bytes
+ * (e.g. ipfs add --chunker=size-65536 --raw-leaves).
+ */
+class CarStream : public DecodeStream
+{
+public:
+    /// gateway is the url prefix blocks are fetched from, e.g. "https://ipfs.io/ipfs/"
+    CarStream(Stream& src, const String& gateway, size_t maxBlock = CAR_STREAM_MAX_BLOCK);
+    ~CarStream(void);
+
+    /// root is the CID as text (CIDv0 "Qm..." or base32 CIDv1 "b...")
+    bool begin(const String& root);
+
+    uint32_t blocks(void) const
+    {
+        return _blocks;
+    }
+
+    uint32_t refetched(void) const
+    {
+        return _refetched;
+    }
+
+    void onBlock(CarBlockCallback callback)
+    {
+        _onBlock = callback;
+    }
+
+protected:
+    void decode(void);
+
+private:
+    struct Cid {
+        uint8_t len;
+        uint8_t bytes[CAR_STREAM_MAX_CID];
+    };
+
+    bool readSection(const Cid& expected, size_t& len);
+    bool refetch(const Cid& cid, size_t& len);
+    bool verify(const Cid& cid, size_t len);
+    bool publish(const Cid& cid, size_t len);
+    bool push(const uint8_t* bytes, size_t len);
+    bool readVarint(uint64_t& value);
+
+    Stream& _src;
+    String _gateway;
+    size_t _maxBlock;
+    uint8_t* _block;
+    Cid* _stack;
+    size_t _depth;
+    bool _carLost;
+    uint32_t _blocks;
+    uint32_t _refetched;
+    CarBlockCallback _onBlock;
+};
+
+/// parse a CID in text form into its binary form, false if unsupported
+bool cidFromString(const String& text, uint8_t* bytes, uint8_t& len);
+/// base32 CIDv1 text of a binary CID (CIDv0 is upgraded to dag-pb CIDv1)
+String cidToString(const uint8_t* bytes, uint8_t len);
+
+#endif /* ___CAR_STREAM_H___ */
@@ -0,0 +1,77 @@
+/**
+ * ChunkedStream.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "ChunkedStream.h"
+
+ChunkedStream::ChunkedStream(Stream& src)
+        : _src(src), _chunkRemaining(0), _inChunk(false), _total(0)
+{
+}
+
+void ChunkedStream::decode(void)
+{
+    if(!_inChunk) {
+        // <hex size>[;extension]\r\n
+        String line;
+        if(!readLine(line) || line.length() == 0) {
+            log_e("chunk header missing after %u bytes\n", _total);
+            _failed = true;
+            return;
+        }
+        char * end;
+        _chunkRemaining = strtoul(line.c_str(), &end, 16);
+        if(end == line.c_str()) {
+            log_e("chunk header invalid: %s\n", line.c_str());
+            _failed = true;
+            return;
+        }
+
+        if(_chunkRemaining == 0) {
+            // skip trailer fields up to the closing empty line
+            while(readLine(line)) {
+                if(line.length() == 0) {
+                    _finished = true;
+                    return;
+                }
+            }
+            _failed = true;
+            return;
+        }
+        _inChunk = true;
+    }
+
+    size_t n = (_chunkRemaining > sizeof(_buf)) ? sizeof(_buf) : _chunkRemaining;
+    n = _src.readBytes((char *) _buf, n);
+    if(n == 0) {
+        log_e("chunk body timeout after %u bytes\n", _total);
+        _failed = true;
+        return;
+    }
+    _data = _buf;
+    _len = n;
+    _total += n;
+    _chunkRemaining -= n;
+
+    if(_chunkRemaining == 0) {
+        String line;
+        if(!readLine(line) || line.length() != 0) {
+            log_e("chunk not terminated by CRLF\n");
+            _failed = true;
+            return;
+        }
+        _inChunk = false;
+    }
+}
+
+bool ChunkedStream::readLine(String& line)
+{
+    line = _src.readStringUntil('\n');
+    if(!line.endsWith("\r")) {
+        return false;
+    }
+    line.remove(line.length() - 1);
+    return true;
+}
@@ -0,0 +1,41 @@
+/**
+ * ChunkedStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___CHUNKED_STREAM_H___
+#define ___CHUNKED_STREAM_H___
+
+#include "DecodeStream.h"
+
+/**
+ * removes HTTP/1.1 chunked transfer encoding from a response body
+ *
+ * finished() reports true once the terminating zero length chunk and the
+ * trailer were read, so a truncated response is never taken for a complete one.
+ */
+class ChunkedStream : public DecodeStream
+{
+public:
+    ChunkedStream(Stream& src);
+
+    /// payload bytes so far
+    uint32_t size(void) const
+    {
+        return _total;
+    }
+
+protected:
+    void decode(void);
+
+private:
+    bool readLine(String& line);
+
+    Stream& _src;
+    uint32_t _chunkRemaining;
+    bool _inChunk;
+    uint32_t _total;
+    uint8_t _buf[512];
+};
+
+#endif /* ___CHUNKED_STREAM_H___ */
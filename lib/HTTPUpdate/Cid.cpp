@@ -0,0 +1,149 @@
+/**
+ * Cid.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "Cid.h"
+#include <string.h>
+
+static const char base58Alphabet[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+static const char base32Alphabet[] = "abcdefghijklmnopqrstuvwxyz234567";
+
+bool cidVarint(const uint8_t* p, size_t len, size_t& pos, uint64_t& value)
+{
+    value = 0;
+    for(int shift = 0; shift < 64 && pos < len; shift += 7) {
+        uint8_t b = p[pos++];
+        value |= (uint64_t) (b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t cidParse(const uint8_t* p, size_t len, uint64_t& codec, const uint8_t** digest)
+{
+    // CIDv0 is a bare sha2-256 multihash of a dag-pb block
+    if(len >= 34 && p[0] == MULTIHASH_SHA2_256 && p[1] == 32) {
+        codec = CID_CODEC_DAG_PB;
+        *digest = p + 2;
+        return 34;
+    }
+
+    size_t pos = 0;
+    uint64_t version, hash, digestLen;
+    if(!cidVarint(p, len, pos, version) || version != 1 || !cidVarint(p, len, pos, codec)
+            || !cidVarint(p, len, pos, hash) || !cidVarint(p, len, pos, digestLen)
+            || hash != MULTIHASH_SHA2_256 || digestLen != 32 || pos + digestLen > len) {
+        return 0;
+    }
+    *digest = p + pos;
+    return pos + digestLen;
+}
+
+bool cidFromText(const char* text, uint8_t* bytes, uint8_t& len)
+{
+    uint8_t buf[CID_MAX_BYTES];
+    size_t count = 0;
+
+    if(strncmp(text, "Qm", 2) == 0) {
+        memset(buf, 0, sizeof(buf));
+        for(const char* c = text; *c; c++) {
+            const char* digit = strchr(base58Alphabet, *c);
+            if(!digit) {
+                return false;
+            }
+            uint32_t carry = digit - base58Alphabet;
+            for(int j = sizeof(buf) - 1; j >= 0; j--) {
+                carry += 58 * buf[j];
+                buf[j] = carry & 0xff;
+                carry >>= 8;
+            }
+            if(carry) {
+                return false;
+            }
+        }
+        size_t first = 0;
+        while(first < sizeof(buf) && buf[first] == 0) {
+            first++;
+        }
+        count = sizeof(buf) - first;
+        memmove(buf, buf + first, count);
+    } else if(text[0] == 'b') {
+        uint32_t acc = 0;
+        int bits = 0;
+        for(const char* c = text + 1; *c; c++) {
+            const char* digit = strchr(base32Alphabet, *c);
+            if(!digit) {
+                return false;
+            }
+            acc = (acc << 5) | (digit - base32Alphabet);
+            bits += 5;
+            if(bits >= 8) {
+                if(count >= sizeof(buf)) {
+                    return false;
+                }
+                bits -= 8;
+                buf[count++] = (acc >> bits) & 0xff;
+            }
+        }
+    } else {
+        return false;
+    }
+
+    uint64_t codec;
+    const uint8_t* digest;
+    if(cidParse(buf, count, codec, &digest) != count) {
+        return false;
+    }
+    memcpy(bytes, buf, count);
+    len = count;
+    return true;
+}
+
+bool cidRawSha256(const char* text, uint8_t* sha256)
+{
+    uint8_t bytes[CID_MAX_BYTES];
+    uint8_t len;
+    uint64_t codec;
+    const uint8_t* digest;
+    if(!cidFromText(text, bytes, len) || !cidParse(bytes, len, codec, &digest) || codec != CID_CODEC_RAW) {
+        return false;
+    }
+    memcpy(sha256, digest, 32);
+    return true;
+}
+
+void cidToText(const uint8_t* bytes, uint8_t len, char* text)
+{
+    uint8_t buf[CID_MAX_BYTES + 2];
+    size_t count = 0;
+    if(len > CID_MAX_BYTES) {
+        len = CID_MAX_BYTES;
+    }
+    if(len == 34 && bytes[0] == MULTIHASH_SHA2_256) {
+        buf[count++] = 0x01;
+        buf[count++] = CID_CODEC_DAG_PB;
+    }
+    memcpy(buf + count, bytes, len);
+    count += len;
+
+    size_t out = 0;
+    text[out++] = 'b';
+    uint32_t acc = 0;
+    int bits = 0;
+    for(size_t i = 0; i < count; i++) {
+        acc = (acc << 8) | buf[i];
+        bits += 8;
+        while(bits >= 5) {
+            bits -= 5;
+            text[out++] = base32Alphabet[(acc >> bits) & 0x1f];
+        }
+    }
+    if(bits > 0) {
+        text[out++] = base32Alphabet[(acc << (5 - bits)) & 0x1f];
+    }
+    text[out] = 0;
+}
@@ -0,0 +1,46 @@
+/**
+ * Cid.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___CID_H___
+#define ___CID_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CID_MAX_BYTES               (40)
+/// "b" and the base32 of a CIDv1 of CID_MAX_BYTES + 2, with the terminator
+#define CID_MAX_TEXT                (72)
+
+#define CID_CODEC_RAW               (0x55)
+#define CID_CODEC_DAG_PB            (0x70)
+#define MULTIHASH_SHA2_256          (0x12)
+
+/**
+ * CID and multihash parsing of CarStream
+ *
+ * free of the framework so the native tests build it; only sha2-256
+ * multihashes are supported, as CIDv0 ("Qm...", base58) or base32 CIDv1
+ * ("b...").
+ */
+
+/// unsigned LEB128 varint at p[pos], pos moves past it
+bool cidVarint(const uint8_t* p, size_t len, size_t& pos, uint64_t& value);
+
+/**
+ * split a binary CID into codec and sha2-256 digest
+ * @return length of the CID, 0 if it is not a supported CID
+ */
+size_t cidParse(const uint8_t* p, size_t len, uint64_t& codec, const uint8_t** digest);
+
+/// parse a CID in text form into its binary form (at most CID_MAX_BYTES), false if unsupported
+bool cidFromText(const char* text, uint8_t* bytes, uint8_t& len);
+
+/// sha2-256 of the whole file for a raw CID (a single block), false for other CIDs, e.g. a dag-pb root
+bool cidRawSha256(const char* text, uint8_t* sha256);
+
+/// base32 CIDv1 text of a binary CID (CIDv0 is upgraded to dag-pb CIDv1), text holds CID_MAX_TEXT
+void cidToText(const uint8_t* bytes, uint8_t len, char* text);
+
+#endif /* ___CID_H___ */
@@ -0,0 +1,114 @@
+/**
+ * DecodeStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___DECODE_STREAM_H___
+#define ___DECODE_STREAM_H___
+
+#include <functional>
+#include <Arduino.h>
+#include <Stream.h>
+
+/// called while a stage waits for its source, return false to give up
+typedef std::function<bool(void)> StreamTickCallback;
+
+/**
+ * base for stream stages between the network and Update whose decoded
+ * length is not known up front (compression, transfer encodings, ...)
+ *
+ * subclasses implement decode() which publishes the next window of decoded
+ * bytes in _data/_len and sets _finished once the input ended cleanly
+ * and passed its own checks, or _failed on any error.
+ */
+class DecodeStream : public Stream
+{
+public:
+    virtual ~DecodeStream(void)
+    {
+    }
+
+    int available()
+    {
+        return fill() ? (int) (_len - _pos) : 0;
+    }
+
+    int read()
+    {
+        return fill() ? _data[_pos++] : -1;
+    }
+
+    int peek()
+    {
+        return fill() ? _data[_pos] : -1;
+    }
+
+    size_t readBytes(char *buffer, size_t length)
+    {
+        size_t count = 0;
+        while(count < length && fill()) {
+            size_t n = _len - _pos;
+            if(n > length - count) {
+                n = length - count;
+            }
+            memcpy(buffer + count, _data + _pos, n);
+            _pos += n;
+            count += n;
+        }
+        return count;
+    }
+
+    size_t readBytes(uint8_t *buffer, size_t length)
+    {
+        return readBytes((char *) buffer, length);
+    }
+
+    size_t write(uint8_t)
+    {
+        return 0;
+    }
+
+    void flush()
+    {
+    }
+
+    bool finished(void) const
+    {
+        return _finished && _pos >= _len;
+    }
+
+    bool failed(void) const
+    {
+        return _failed;
+    }
+
+    /// read on past the bytes taken so far, true only if nothing follows and the input ended cleanly
+    bool ended(void)
+    {
+        return peek() < 0 && finished();
+    }
+
+protected:
+    virtual void decode(void) = 0;
+
+    const uint8_t * _data = NULL;
+    size_t _len = 0;
+    size_t _pos = 0;
+    bool _finished = false;
+    bool _failed = false;
+
+private:
+    bool fill(void)
+    {
+        while(_pos >= _len) {
+            if(_finished || _failed) {
+                return false;
+            }
+            _pos = _len = 0;
+            decode();
+        }
+        return true;
+    }
+};
+
+#endif /* ___DECODE_STREAM_H___ */
@@ -0,0 +1,54 @@
+/**
+ * DeltaPatch.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "DeltaPatch.h"
+
+DeltaPatch::DeltaPatch(const uint8_t* old, uint32_t oldSize, uint32_t newSize)
+        : _old(old), _oldSize(oldSize), _newSize(newSize), _oldPos(0), _written(0), _diffLeft(0), _extraLeft(0), _seek(0)
+{
+}
+
+bool DeltaPatch::control(const delta_control_t& control)
+{
+    if(pending() > 0 || control.diffLen > _newSize - _written
+            || control.extraLen > _newSize - _written - control.diffLen
+            || control.diffLen > _oldSize - _oldPos) {
+        return false;
+    }
+    _diffLeft = control.diffLen;
+    _extraLeft = control.extraLen;
+    _seek = control.seek;
+    return true;
+}
+
+void DeltaPatch::apply(uint8_t* buf, size_t n)
+{
+    if(n > pending()) {
+        n = pending();
+    }
+    // diff bytes are added to the old image, extra bytes are copied as is
+    if(_diffLeft) {
+        for(size_t i = 0; i < n; i++) {
+            buf[i] += _old[_oldPos + i];
+        }
+        _oldPos += n;
+        _diffLeft -= n;
+    } else {
+        _extraLeft -= n;
+    }
+    _written += n;
+}
+
+bool DeltaPatch::seek(void)
+{
+    int64_t pos = (int64_t) _oldPos + _seek;
+    if(pending() > 0 || pos < 0 || pos > _oldSize) {
+        return false;
+    }
+    _oldPos = (uint32_t) pos;
+    _seek = 0;
+    return true;
+}
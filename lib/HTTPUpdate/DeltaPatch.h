@@ -0,0 +1,77 @@
+/**
+ * DeltaPatch.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___DELTA_PATCH_H___
+#define ___DELTA_PATCH_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// stream format see HTTP_UPDATE_DELTA_MAGIC
+typedef struct __attribute__((packed)) {
+    uint8_t magic[4];
+    uint32_t oldSize;
+    uint32_t newSize;
+    uint8_t oldSha256[32];
+    uint8_t newSha256[32];
+} delta_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t diffLen;
+    uint32_t extraLen;
+    int32_t seek;
+} delta_control_t;
+
+/**
+ * applies the control blocks of a delta patch to the old image
+ *
+ * the caller reads the patch and writes the result, the patch only checks
+ * that every block stays inside both images and turns patch bytes into
+ * image bytes in place. It is free of the framework so the native tests
+ * build it.
+ */
+class DeltaPatch
+{
+public:
+    /// old is the base image (e.g. the mapped running partition)
+    DeltaPatch(const uint8_t* old, uint32_t oldSize, uint32_t newSize);
+
+    /// start the next block, false if it reaches past either image
+    bool control(const delta_control_t& control);
+
+    /// patch bytes still to read for the current block, never spans its diff and extra part
+    uint32_t pending(void) const
+    {
+        return _diffLeft ? _diffLeft : _extraLeft;
+    }
+
+    /// turn n (at most pending()) patch bytes into image bytes in place
+    void apply(uint8_t* buf, size_t n);
+
+    /// move in the old image once the block is done, false if the seek leaves it
+    bool seek(void);
+
+    uint32_t written(void) const
+    {
+        return _written;
+    }
+
+    bool finished(void) const
+    {
+        return _written == _newSize;
+    }
+
+private:
+    const uint8_t* _old;
+    uint32_t _oldSize;
+    uint32_t _newSize;
+    uint32_t _oldPos;
+    uint32_t _written;
+    uint32_t _diffLeft;
+    uint32_t _extraLeft;
+    int32_t _seek;
+};
+
+#endif /* ___DELTA_PATCH_H___ */
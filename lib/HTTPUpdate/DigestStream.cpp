@@ -0,0 +1,58 @@
+/**
+ * DigestStream.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "DigestStream.h"
+#include <mbedtls/sha256.h>
+
+DigestStream::DigestStream(DecodeStream& src, const uint8_t* sha256)
+        : _src(src), _ctx(NULL), _mismatch(false)
+{
+    memcpy(_expected, sha256, sizeof(_expected));
+}
+
+DigestStream::~DigestStream(void)
+{
+    if(_ctx) {
+        mbedtls_sha256_free(_ctx);
+        free(_ctx);
+    }
+}
+
+void DigestStream::decode(void)
+{
+    if(!_ctx) {
+        _ctx = (mbedtls_sha256_context *) malloc(sizeof(mbedtls_sha256_context));
+        if(!_ctx) {
+            log_e("no memory for the digest\n");
+            _failed = true;
+            return;
+        }
+        mbedtls_sha256_init(_ctx);
+        mbedtls_sha256_starts_ret(_ctx, 0);
+    }
+
+    size_t n = _src.readBytes(_buf, sizeof(_buf));
+    if(n > 0) {
+        mbedtls_sha256_update_ret(_ctx, _buf, n);
+        _data = _buf;
+        _len = n;
+        return;
+    }
+
+    if(!_src.finished()) {
+        _failed = true;
+        return;
+    }
+    uint8_t sha256[32];
+    mbedtls_sha256_finish_ret(_ctx, sha256);
+    if(memcmp(sha256, _expected, sizeof(sha256)) != 0) {
+        log_e("SHA-256 of the image does not match\n");
+        _mismatch = true;
+        _failed = true;
+        return;
+    }
+    _finished = true;
+}
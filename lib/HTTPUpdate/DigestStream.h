@@ -0,0 +1,45 @@
+/**
+ * DigestStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___DIGEST_STREAM_H___
+#define ___DIGEST_STREAM_H___
+
+#include "DecodeStream.h"
+
+#define DIGEST_STREAM_BUFFER        (512)
+
+struct mbedtls_sha256_context;
+
+/**
+ * passes a decoded stream through and hashes it with SHA-256
+ *
+ * finished() only reports true once the source finished and the digest
+ * matched the expected one, so an image from unauthenticated sources is
+ * never committed unless it is exactly the one asked for.
+ */
+class DigestStream : public DecodeStream
+{
+public:
+    DigestStream(DecodeStream& src, const uint8_t* sha256);
+    ~DigestStream(void);
+
+    /// the source finished, but its bytes hash to something else
+    bool mismatch(void) const
+    {
+        return _mismatch;
+    }
+
+protected:
+    void decode(void);
+
+private:
+    DecodeStream& _src;
+    uint8_t _expected[32];
+    mbedtls_sha256_context* _ctx;
+    uint8_t _buf[DIGEST_STREAM_BUFFER];
+    bool _mismatch;
+};
+
+#endif /* ___DIGEST_STREAM_H___ */
@@ -0,0 +1,144 @@
+/**
+ * FlashModel.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "FlashModel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#include <thread>
+#define log_e(...)
+#endif
+
+FlashModel::FlashModel(uint32_t size, FlashModelErase erase, bool realtime, bool store)
+        : _size(size), _sectors(size / FLASH_MODEL_SECTOR_SIZE), _eraseMode(erase), _realtime(realtime), _store(store),
+          _data(NULL), _counts(NULL), _erased(NULL), _offset(0), _erases(0), _pages(0), _busy(0)
+{
+}
+
+FlashModel::~FlashModel(void)
+{
+    free(_data);
+    free(_counts);
+    free(_erased);
+}
+
+bool FlashModel::begin(uint32_t imageSize)
+{
+    if(!_counts) {
+        _counts = (uint16_t *) calloc(_sectors, sizeof(uint16_t));
+        _erased = (uint8_t *) calloc((_sectors + 7) / 8, 1);
+    }
+    if(_store && !_data) {
+        // never erased flash reads as 0xff too
+        _data = (uint8_t *) malloc(_size);
+        if(_data) {
+            memset(_data, 0xff, _size);
+        }
+    }
+    if(!_counts || !_erased || (_store && !_data) || imageSize > _size) {
+        log_e("flash model for %u bytes not available\n", imageSize);
+        return false;
+    }
+
+    // the previous image left every sector written
+    memset(_erased, 0, (_sectors + 7) / 8);
+    _offset = 0;
+    _pages = 0;
+    _busy = 0;
+
+    if(_eraseMode == FLASH_MODEL_ERASE_AHEAD && imageSize) {
+        for(uint32_t sector = 0; sector < (imageSize + FLASH_MODEL_SECTOR_SIZE - 1) / FLASH_MODEL_SECTOR_SIZE; sector++) {
+            erase(sector);
+        }
+    }
+    return true;
+}
+
+size_t FlashModel::write(const uint8_t* data, size_t len)
+{
+    if(!_counts || len == 0) {
+        return 0;
+    }
+    if(len > _size - _offset) {
+        len = _size - _offset;
+        if(len == 0) {
+            return 0;
+        }
+    }
+
+    uint32_t end = _offset + len;
+    for(uint32_t sector = _offset / FLASH_MODEL_SECTOR_SIZE; sector <= (end - 1) / FLASH_MODEL_SECTOR_SIZE; sector++) {
+        if(!(_erased[sector / 8] & (1 << (sector % 8)))) {
+            erase(sector);
+        }
+    }
+
+    if(_data) {
+        for(size_t i = 0; i < len; i++) {
+            _data[_offset + i] &= data[i];
+        }
+    }
+
+    // a partial page costs a whole program cycle
+    uint32_t pages = (end - 1) / FLASH_MODEL_PAGE_SIZE - _offset / FLASH_MODEL_PAGE_SIZE + 1;
+    _pages += pages;
+    _busy += pages * FLASH_MODEL_PAGE_US;
+    spend(pages * FLASH_MODEL_PAGE_US);
+
+    _offset = end;
+    return len;
+}
+
+void FlashModel::reset(void)
+{
+    if(_counts) {
+        memset(_counts, 0, _sectors * sizeof(uint16_t));
+    }
+    _erases = 0;
+}
+
+uint16_t FlashModel::maxErases(void) const
+{
+    uint16_t most = 0;
+    for(uint32_t sector = 0; _counts && sector < _sectors; sector++) {
+        if(_counts[sector] > most) {
+            most = _counts[sector];
+        }
+    }
+    return most;
+}
+
+void FlashModel::erase(uint32_t sector)
+{
+    _erased[sector / 8] |= 1 << (sector % 8);
+    if(_data) {
+        memset(_data + sector * FLASH_MODEL_SECTOR_SIZE, 0xff, FLASH_MODEL_SECTOR_SIZE);
+    }
+    _counts[sector]++;
+    _erases++;
+    _busy += FLASH_MODEL_ERASE_US;
+    spend(FLASH_MODEL_ERASE_US);
+}
+
+void FlashModel::spend(uint32_t us)
+{
+    if(!_realtime) {
+        return;
+    }
+#ifdef ARDUINO
+    // whole milliseconds as a task delay, the rest busy waiting
+    if(us >= 1000) {
+        delay(us / 1000);
+    }
+    delayMicroseconds(us % 1000);
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+#endif
+}
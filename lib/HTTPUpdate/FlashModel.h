@@ -0,0 +1,109 @@
+/**
+ * FlashModel.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___FLASH_MODEL_H___
+#define ___FLASH_MODEL_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLASH_MODEL_SECTOR_SIZE     4096
+#define FLASH_MODEL_PAGE_SIZE       256
+/// typical figures of the 4 MB SPI NOR parts on ESP32 modules
+#define FLASH_MODEL_ERASE_US        45000
+#define FLASH_MODEL_PAGE_US         700
+
+enum FlashModelErase {
+    FLASH_MODEL_ERASE_INLINE,   ///< erase each sector when the first byte reaches it, like Update
+    FLASH_MODEL_ERASE_AHEAD     ///< erase the whole image range in begin()
+};
+
+/**
+ * stands in for the OTA partition when writes should be measured, not made
+ *
+ * writes are sequential from offset 0 like Update's; the model counts
+ * sector erases (kept across runs, see reset()) and page programs, adds up
+ * the time they would take and, in real time mode, spends that time so end
+ * to end throughput matches real flash.
+ *
+ * the model has no ESP-IDF dependency so it also runs in the native build;
+ * on the device pass the size of the OTA partition, e.g.
+ * esp_ota_get_next_update_partition(NULL)->size. With store set the bytes
+ * are kept in RAM like NOR flash keeps them (erase sets 0xff, programming
+ * only clears bits) and can be read back with data().
+ */
+class FlashModel
+{
+public:
+    FlashModel(uint32_t size, FlashModelErase erase = FLASH_MODEL_ERASE_INLINE, bool realtime = true,
+               bool store = false);
+    ~FlashModel(void);
+
+    /// start an image at offset 0, imageSize 0 if unknown (AHEAD then erases inline)
+    bool begin(uint32_t imageSize = 0);
+    size_t write(const uint8_t* data, size_t len);
+
+    /// forget the erase counts
+    void reset(void);
+
+    uint32_t written(void) const
+    {
+        return _offset;
+    }
+
+    uint32_t erases(void) const
+    {
+        return _erases;
+    }
+
+    uint16_t erases(uint32_t sector) const
+    {
+        return (_counts && sector < _sectors) ? _counts[sector] : 0;
+    }
+
+    uint16_t maxErases(void) const;
+
+    uint32_t pagePrograms(void) const
+    {
+        return _pages;
+    }
+
+    /// microseconds the modelled flash was busy since begin()
+    uint32_t busyTime(void) const
+    {
+        return _busy;
+    }
+
+    uint32_t size(void) const
+    {
+        return _size;
+    }
+
+    /// contents, NULL unless the model was made with store
+    const uint8_t* data(void) const
+    {
+        return _data;
+    }
+
+private:
+    void erase(uint32_t sector);
+    void spend(uint32_t us);
+
+    uint32_t _size;
+    uint32_t _sectors;
+    FlashModelErase _eraseMode;
+    bool _realtime;
+    bool _store;
+
+    uint8_t* _data;
+    uint16_t* _counts;
+    uint8_t* _erased;
+    uint32_t _offset;
+    uint32_t _erases;
+    uint32_t _pages;
+    uint32_t _busy;
+};
+
+#endif /* ___FLASH_MODEL_H___ */
@@ -0,0 +1,180 @@
+/**
+ * GzipStream.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "GzipStream.h"
+#include "GzipTrailer.h"
+
+#if __has_include("esp32/rom/miniz.h")
+#include "esp32/rom/miniz.h"
+#else
+#include "rom/miniz.h"
+#endif
+
+#define GZIP_FLAG_HCRC      (0x02)
+#define GZIP_FLAG_EXTRA     (0x04)
+#define GZIP_FLAG_NAME      (0x08)
+#define GZIP_FLAG_COMMENT   (0x10)
+
+GzipStream::GzipStream(Stream& src, size_t srcSize)
+        : _src(src), _srcRemaining(srcSize), _srcBounded(srcSize > 0), _srcEnded(false),
+          _inflator(NULL), _dict(NULL), _dictPos(0), _inPos(0), _inLen(0), _crc(0), _total(0)
+{
+}
+
+GzipStream::~GzipStream(void)
+{
+    free(_inflator);
+    free(_dict);
+}
+
+bool GzipStream::begin(void)
+{
+    _inflator = (tinfl_decompressor *) malloc(sizeof(tinfl_decompressor));
+    _dict = (uint8_t *) malloc(TINFL_LZ_DICT_SIZE);
+    if(!_inflator || !_dict) {
+        log_e("no memory for inflate window\n");
+        _failed = true;
+        return false;
+    }
+    tinfl_init(_inflator);
+
+    uint8_t header[10];
+    if(!readIn(header, sizeof(header)) || header[0] != GZIP_MAGIC_0 || header[1] != GZIP_MAGIC_1 || header[2] != 8) {
+        log_e("gzip header invalid\n");
+        _failed = true;
+        return false;
+    }
+
+    uint8_t flags = header[3];
+    if(flags & GZIP_FLAG_EXTRA) {
+        uint8_t extra[2];
+        if(!readIn(extra, sizeof(extra))) {
+            _failed = true;
+            return false;
+        }
+        for(size_t skip = extra[0] | (extra[1] << 8); skip > 0; skip--) {
+            if(!readIn(extra, 1)) {
+                _failed = true;
+                return false;
+            }
+        }
+    }
+    if(((flags & GZIP_FLAG_NAME) && !skipString()) || ((flags & GZIP_FLAG_COMMENT) && !skipString())) {
+        _failed = true;
+        return false;
+    }
+    if(flags & GZIP_FLAG_HCRC) {
+        uint8_t hcrc[2];
+        if(!readIn(hcrc, sizeof(hcrc))) {
+            _failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+void GzipStream::decode(void)
+{
+    if(_inPos >= _inLen) {
+        fillIn();
+    }
+
+    size_t inBytes = _inLen - _inPos;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - _dictPos;
+    tinfl_status status = tinfl_decompress(_inflator, _in + _inPos, &inBytes, _dict, _dict + _dictPos, &outBytes,
+            moreInput() ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+    _inPos += inBytes;
+
+    _data = _dict + _dictPos;
+    _len = outBytes;
+    _dictPos = (_dictPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    _crc = gzipCrc32(_crc, _data, _len);
+    _total += _len;
+
+    if(status == TINFL_STATUS_DONE) {
+        if(checkTrailer()) {
+            _finished = true;
+        } else {
+            log_e("gzip trailer mismatch after %u bytes\n", _total);
+            _failed = true;
+        }
+    } else if(status < 0) {
+        log_e("inflate failed (%d) after %u bytes\n", status, _total);
+        _failed = true;
+    }
+}
+
+bool GzipStream::checkTrailer(void)
+{
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+
+    // the decoder may have pulled the first trailer bytes into its bit buffer
+    size_t have = gzipTrailerFromBits(_inflator->m_bit_buf, _inflator->m_num_bits, trailer);
+    if(!readIn(trailer + have, sizeof(trailer) - have)) {
+        return false;
+    }
+    return gzipTrailerMatches(trailer, _crc, _total);
+}
+
+bool GzipStream::moreInput(void) const
+{
+    if(_srcEnded) {
+        return false;
+    }
+    return _srcBounded ? _srcRemaining > 0 : !_srcEnded;
+}
+
+bool GzipStream::fillIn(void)
+{
+    size_t n = sizeof(_in);
+    if(_srcBounded && n > _srcRemaining) {
+        n = _srcRemaining;
+    }
+    if(n == 0 || _srcEnded) {
+        return false;
+    }
+
+    n = _src.readBytes((char *) _in, n);
+    if(n == 0) {
+        _srcEnded = true;
+        return false;
+    }
+    if(_srcBounded) {
+        _srcRemaining -= n;
+    }
+    _inPos = 0;
+    _inLen = n;
+    return true;
+}
+
+bool GzipStream::readIn(uint8_t* dst, size_t len)
+{
+    while(len > 0) {
+        if(_inPos >= _inLen && !fillIn()) {
+            return false;
+        }
+        size_t n = _inLen - _inPos;
+        if(n > len) {
+            n = len;
+        }
+        memcpy(dst, _in + _inPos, n);
+        _inPos += n;
+        dst += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool GzipStream::skipString(void)
+{
+    uint8_t c;
+    do {
+        if(!readIn(&c, 1)) {
+            return false;
+        }
+    } while(c != 0);
+    return true;
+}
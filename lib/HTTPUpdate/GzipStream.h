@@ -0,0 +1,66 @@
+/**
+ * GzipStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___GZIP_STREAM_H___
+#define ___GZIP_STREAM_H___
+
+#include "DecodeStream.h"
+
+#define GZIP_MAGIC_0        (0x1F)
+#define GZIP_MAGIC_1        (0x8B)
+
+struct tinfl_decompressor_tag;
+
+/**
+ * inflates a gzip stream on the fly using the tinfl decoder in ROM
+ *
+ * RAM use is bounded by the 32 KB deflate window plus the decoder state
+ * (about 11 KB), independent of the image size. CRC32 and length from the
+ * gzip trailer are checked before finished() reports true.
+ */
+class GzipStream : public DecodeStream
+{
+public:
+    /// srcSize is the compressed length, 0 reads until the source runs dry
+    GzipStream(Stream& src, size_t srcSize = 0);
+    ~GzipStream(void);
+
+    /// allocate the window and parse the gzip header
+    bool begin(void);
+
+    /// decoded bytes so far
+    uint32_t size(void) const
+    {
+        return _total;
+    }
+
+protected:
+    void decode(void);
+
+private:
+    bool fillIn(void);
+    bool readIn(uint8_t* dst, size_t len);
+    bool skipString(void);
+    bool moreInput(void) const;
+    bool checkTrailer(void);
+
+    Stream& _src;
+    size_t _srcRemaining;
+    bool _srcBounded;
+    bool _srcEnded;
+
+    tinfl_decompressor_tag* _inflator;
+    uint8_t* _dict;
+    size_t _dictPos;
+
+    uint8_t _in[512];
+    size_t _inPos;
+    size_t _inLen;
+
+    uint32_t _crc;
+    uint32_t _total;
+};
+
+#endif /* ___GZIP_STREAM_H___ */
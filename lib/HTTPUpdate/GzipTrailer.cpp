@@ -0,0 +1,42 @@
+/**
+ * GzipTrailer.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "GzipTrailer.h"
+
+uint32_t gzipCrc32(uint32_t crc, const uint8_t* data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+    for(size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+size_t gzipTrailerFromBits(uint64_t bitBuf, uint32_t numBits, uint8_t* trailer)
+{
+    // the deflate end is not byte aligned, the bits up to the next byte boundary are padding
+    size_t have = 0;
+    bitBuf >>= (numBits & 7);
+    for(numBits >>= 3; numBits > 0 && have < GZIP_TRAILER_SIZE; numBits--) {
+        trailer[have++] = bitBuf & 0xff;
+        bitBuf >>= 8;
+    }
+    return have;
+}
+
+bool gzipTrailerMatches(const uint8_t* trailer, uint32_t crc, uint32_t total)
+{
+    uint32_t tcrc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t) trailer[3] << 24);
+    uint32_t isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | ((uint32_t) trailer[7] << 24);
+    return tcrc == crc && isize == total;
+}
@@ -0,0 +1,31 @@
+/**
+ * GzipTrailer.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___GZIP_TRAILER_H___
+#define ___GZIP_TRAILER_H___
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GZIP_TRAILER_SIZE   (8)
+
+/**
+ * gzip trailer check of GzipStream
+ *
+ * kept free of the framework and the ROM decoder so the native tests
+ * build it; GzipStream feeds in the decoder's bit buffer and the bytes
+ * read after the deflate stream.
+ */
+
+/// CRC-32 (IEEE, as in gzip) over len more bytes, start with crc 0
+uint32_t gzipCrc32(uint32_t crc, const uint8_t* data, size_t len);
+
+/// whole bytes the decoder pulled past the deflate end into its bit buffer, returns how many went to trailer
+size_t gzipTrailerFromBits(uint64_t bitBuf, uint32_t numBits, uint8_t* trailer);
+
+/// true if the little endian CRC-32 and ISIZE of the trailer match the decoded data
+bool gzipTrailerMatches(const uint8_t* trailer, uint32_t crc, uint32_t total);
+
+#endif /* ___GZIP_TRAILER_H___ */
@@ -24,10 +24,29 @@
  */
 
 #include "HTTPUpdate.h"
+#include "DeltaPatch.h"
+#include "ImageState.h"
 #include <StreamString.h>
 
+#include <esp_attr.h>
 #include <esp_partition.h>
 #include <esp_ota_ops.h>                // get running partition
+#include <mbedtls/sha256.h>
+#include <Preferences.h>
+#include <MD5Builder.h>
+
+#define ACTIVATION_MAGIC    0x41435456
+
+// IDF 3.3 predates the option, it only builds for the ESP32 (chip id 0)
+#ifndef CONFIG_IDF_FIRMWARE_CHIP_ID
+#define CONFIG_IDF_FIRMWARE_CHIP_ID     0x0000
+#endif
+
+// survives the restart into the activated image
+static RTC_NOINIT_ATTR struct {
+    uint32_t magic;
+    uint32_t elapsed;
+} activationRecord;
 
 // To do extern "C" uint32_t _SPIFFS_start;
 // To do extern "C" uint32_t _SPIFFS_end;
@@ -86,6 +105,146 @@ HTTPUpdateResult HTTPUpdate::update(WiFiClient& client, const String& url,  Stri
     return handleUpdate(http, currentVersion, payload, token, false);
 }
 
+HTTPUpdateResult HTTPUpdate::updateFromMirrors(const String urls[], size_t count, const uint8_t* sha256,
+        const String& currentVersion)
+{
+    _abortRequested = false;
+    _progressAborted = false;
+    if(!sha256) {
+        // the mirrors are not trusted, only the digest says the stitched image is the right one
+        log_e("mirror download without expected SHA-256\n");
+        _lastError = HTTP_UE_SERVER_FAULTY_SHA256;
+        _imageTag = String();
+        return HTTP_UPDATE_FAILED;
+    }
+    RangeStream ranges(_rangeSize, _rangeConnections, _httpClientTimeout);
+    ranges.setCACert(_mirrorCA);
+    ranges.onTick([this]() { return progressTick(); });
+    for(size_t i = 0; i < count; i++) {
+        ranges.addSource(urls[i]);
+    }
+    if(!ranges.begin()) {
+        _lastError = HTTP_UE_NO_MIRROR;
+        _imageTag = String();
+        return HTTP_UPDATE_FAILED;
+    }
+
+    log_d("mirror download: %u bytes, %u mirrors\n", ranges.size(), count);
+    if(currentVersion && currentVersion[0] != 0x00) {
+        log_d(" - current version: %s\n", currentVersion.c_str() );
+    }
+
+    // checked before Update.end(), a wrong image never becomes bootable
+    DigestStream digest(ranges, sha256);
+    HTTPUpdateResult ret = handleStream(digest, ranges.size(), String(), false, &digest);
+    if(ret == HTTP_UPDATE_FAILED && _lastError != HTTP_UE_ABORTED) {
+        if(digest.mismatch()) {
+            _lastError = HTTP_UE_SERVER_FAULTY_SHA256;
+        } else if(ranges.exhausted()) {
+            _lastError = HTTP_UE_NO_MIRROR;
+        }
+    }
+    _imageTag = String();
+    if(ret == HTTP_UPDATE_OK && _rebootOnUpdate && !stagedPartition() && _sink == HTTP_UPDATE_SINK_FLASH) {
+        ESP.restart();
+    }
+    return ret;
+}
+
+HTTPUpdateResult HTTPUpdate::updateFromCid(const String& urlTemplate, const String& cid, const String& currentVersion)
+{
+    // no auth or device headers, so every device asks for the same cache entry
+    String url = urlTemplate;
+    if(url.indexOf("{cid}") < 0) {
+        url += cid;
+    } else {
+        url.replace("{cid}", cid);
+    }
+    // the cache is not trusted, only a raw CID is the digest of the file it serves
+    uint8_t sha256[32];
+    if(!cidRawSha256(cid.c_str(), sha256)) {
+        log_e("CID %s is not a raw block, use updateFromCar\n", cid.c_str());
+        _lastError = HTTP_UE_SERVER_FAULTY_SHA256;
+        return HTTP_UPDATE_FAILED;
+    }
+    return updateFromMirrors(&url, 1, sha256, currentVersion);
+}
+
+HTTPUpdateResult HTTPUpdate::updateFromCar(WiFiClient& client, const String& gateway, const String& cid,
+        const String& currentVersion)
+{
+    _abortRequested = false;
+    _progressAborted = false;
+    HTTPClient http;
+    if(!http.begin(client, gateway + cid + "?format=car")) {
+        _imageTag = String();
+        return HTTP_UPDATE_FAILED;
+    }
+    http.useHTTP10(true);
+    http.setTimeout(_httpClientTimeout);
+    http.setUserAgent("ESP32-http-Update");
+    http.addHeader("Accept", "application/vnd.ipld.car; version=1; order=dfs; dups=y");
+    if(currentVersion && currentVersion[0] != 0x00) {
+        http.addHeader("x-ESP32-version", currentVersion);
+    }
+
+    int code = http.GET();
+    if(code <= 0) {
+        log_e("HTTP error: %s\n", http.errorToString(code).c_str());
+        _lastError = code;
+        http.end();
+        _imageTag = String();
+        return HTTP_UPDATE_FAILED;
+    }
+    if(code != HTTP_CODE_OK) {
+        _lastError = (code == HTTP_CODE_NOT_FOUND) ? HTTP_UE_SERVER_FILE_NOT_FOUND : HTTP_UE_SERVER_WRONG_HTTP_CODE;
+        log_e("HTTP Code is (%d)\n", code);
+        http.end();
+        _imageTag = String();
+        return HTTP_UPDATE_FAILED;
+    }
+
+    _stageStart = millis();
+    // the CAR length says nothing about the image length, the DAG tells when it is complete
+    WatchStream body(*http.getStreamPtr(), _httpClientTimeout, [this]() { return progressTick(); });
+    CarStream car(body, gateway);
+    car.onBlock(_carBlockCallback);
+    if(!car.begin(cid)) {
+        _lastError = HTTP_UE_BLOCK_VERIFY_FAILED;
+        http.end();
+        _imageTag = String();
+        return HTTP_UPDATE_FAILED;
+    }
+    if(car.peek() != 0xE9) {
+        log_e("Magic header does not start with 0xE9\n");
+        _lastError = car.failed() ? HTTP_UE_BLOCK_VERIFY_FAILED : HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+        http.end();
+        _imageTag = String();
+        return HTTP_UPDATE_FAILED;
+    }
+
+    if(_sink == HTTP_UPDATE_SINK_FLASH && stagedPartition()) {
+        storeStagedPartition(NULL);
+    }
+    bool updated = (_sink == HTTP_UPDATE_SINK_FLASH) ? runUpdate(car, String(), U_FLASH) : runDryRun(car, UPDATE_SIZE_UNKNOWN, String(), &car);
+    if(!updated && (_abortRequested || _progressAborted)) {
+        _lastError = HTTP_UE_ABORTED;
+    } else if(!updated && car.failed()) {
+        _lastError = HTTP_UE_BLOCK_VERIFY_FAILED;
+    }
+    log_d("CAR update: %u blocks, %u fetched again\n", car.blocks(), car.refetched());
+    http.end();
+
+    if(updated && _sink == HTTP_UPDATE_SINK_FLASH) {
+        stageDone();
+    }
+    _imageTag = String();
+    if(updated && _rebootOnUpdate && !stagedPartition() && _sink == HTTP_UPDATE_SINK_FLASH) {
+        ESP.restart();
+    }
+    return updated ? HTTP_UPDATE_OK : HTTP_UPDATE_FAILED;
+}
+
 /**
  * return error code as int
  * @return int error code
@@ -138,6 +297,32 @@ String HTTPUpdate::getLastErrorString(void)
         return "New Binary Does Not Fit Flash Size";
     case HTTP_UE_NO_PARTITION:
         return "Partition Could Not be Found";
+    case HTTP_UE_DELTA_BASE_MISMATCH:
+        return "Delta Patch Does Not Match Running Image";
+    case HTTP_UE_DELTA_PATCH_CORRUPT:
+        return "Delta Patch Corrupt";
+    case HTTP_UE_SERVER_FAULTY_SHA256:
+        return "Wrong SHA256";
+    case HTTP_UE_DECOMPRESS_FAILED:
+        return "Decoding Image Stream Failed";
+    case HTTP_UE_NO_MIRROR:
+        return "No Mirror Could Serve The Image";
+    case HTTP_UE_BLOCK_VERIFY_FAILED:
+        return "Block Does Not Match CID";
+    case HTTP_UE_ABORTED:
+        return "Update Aborted";
+    case HTTP_UE_NOT_STAGED:
+        return "No Staged Update";
+    case HTTP_UE_BIN_FOR_WRONG_CHIP:
+        return "New Binary Is For Another Chip";
+    case HTTP_UE_BIN_FOR_WRONG_PROJECT:
+        return "New Binary Is For Another Project";
+    case HTTP_UE_STREAM_ENDED:
+        return "Image Stream Ended Early";
+    case HTTP_UE_ACTIVATE_FAILED:
+        return "Staged Image Could Not Be Activated";
+    case HTTP_UE_NO_MEMORY:
+        return "Not Enough Memory For The Write Buffer";
     }
 
     return String();
@@ -180,9 +365,12 @@ HTTPUpdateResult HTTPUpdate::handleUpdate(HTTPClient& http, const String& curren
 {
 
     HTTPUpdateResult ret = HTTP_UPDATE_FAILED;
+    _abortRequested = false;
+    _progressAborted = false;
 
-    // use HTTP/1.0 for update since the update handler not support any transfer Encoding
-    http.useHTTP10(true);
+    // HTTP/1.1 so the connection can be kept alive, chunked bodies are decoded by ChunkedStream
+    http.useHTTP10(false);
+    http.setReuse(true);
     http.setTimeout(_httpClientTimeout);
     http.setUserAgent("ESP32-http-Update");
     
@@ -213,11 +401,25 @@ HTTPUpdateResult HTTPUpdate::handleUpdate(HTTPClient& http, const String& curren
         http.addHeader("x-ESP32-mode", "sketch");
     }
 
+    if(_deltaUpdate && !spiffs) {
+        http.addHeader("x-ESP32-delta", "1");
+    }
+    http.addHeader("x-ESP32-compression", "gzip");
+
     if(currentVersion && currentVersion[0] != 0x00) {
         http.addHeader("x-ESP32-version", currentVersion);
     }
 
-    const char * headerkeys[] = { "x-MD5" };
+    // lets the server answer 304 for an image that is already running or staged
+    String installed = (_sink == HTTP_UPDATE_SINK_FLASH) ? getInstalledTag() : String();
+    String staged = (_sink == HTTP_UPDATE_SINK_FLASH) ? partitionTag(stagedPartition()) : String();
+    if(installed.length() && staged.length()) {
+        http.addHeader("If-None-Match", installed + ", " + staged);
+    } else if(installed.length() || staged.length()) {
+        http.addHeader("If-None-Match", installed + staged);
+    }
+
+    const char * headerkeys[] = { "x-MD5", "Transfer-Encoding", "ETag" };
     size_t headerkeyssize = sizeof(headerkeys) / sizeof(char*);
 
     // track these headers
@@ -234,11 +436,13 @@ HTTPUpdateResult HTTPUpdate::handleUpdate(HTTPClient& http, const String& curren
     delay(100);
     
     int len = http.getSize();
+    bool chunked = http.header("Transfer-Encoding").equalsIgnoreCase("chunked");
 
     if(code <= 0) {
         log_e("HTTP error: %s\n", http.errorToString(code).c_str());
         _lastError = code;
         http.end();
+        _imageTag = String();
         return HTTP_UPDATE_FAILED;
     }
 
@@ -265,105 +469,34 @@ HTTPUpdateResult HTTPUpdate::handleUpdate(HTTPClient& http, const String& curren
     
     switch(code) {
     case HTTP_CODE_OK:  ///< OK (Start Update)
-        if(len > 0) {
-            bool startUpdate = true;
-            if(spiffs) {
-                Serial.println("spiffs");
-                const esp_partition_t* _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
-                if(!_partition){
-                    _lastError = HTTP_UE_NO_PARTITION;
-                    return HTTP_UPDATE_FAILED;
-                }
-
-                if(len > _partition->size) {
-                    log_e("spiffsSize to low (%d) needed: %d\n", _partition->size, len);
-                    startUpdate = false;
-                }
+        if(len > 0 || chunked) {
+            delay(100);
+
+            _responseTag = http.header("ETag");
+            // progress keeps being sampled while the server sends nothing
+            WatchStream body(*http.getStreamPtr(), _httpClientTimeout, [this]() { return progressTick(); });
+            ChunkedStream chunks(body);
+            if(chunked) {
+                ret = handleStream(chunks, UPDATE_SIZE_UNKNOWN, http.header("x-MD5"), spiffs, &chunks);
+                log_d("chunked body: %u bytes\n", chunks.size());
             } else {
-                int sketchFreeSpace = ESP.getFreeSketchSpace();
-                if(!sketchFreeSpace){
-                    _lastError = HTTP_UE_NO_PARTITION;
-                    return HTTP_UPDATE_FAILED;
-                }
-
-                if(len > sketchFreeSpace) {
-                    log_e("FreeSketchSpace to low (%d) needed: %d\n", sketchFreeSpace, len);
-                    startUpdate = false;
-                }
+                ret = handleStream(body, len, http.header("x-MD5"), spiffs);
             }
+            if(ret == HTTP_UPDATE_OK) {
+                log_d("Update ok\n");
+                http.end();
 
-            if(!startUpdate) {
-                _lastError = HTTP_UE_TOO_LESS_SPACE;
-                ret = HTTP_UPDATE_FAILED;
-            } else {
-
-                WiFiClient * tcp = http.getStreamPtr();
-
-// To do?                WiFiUDP::stopAll();
-// To do?                WiFiClient::stopAllExcept(tcp);
-
-                delay(100);
-
-                int command;
-
-                if(spiffs) {
-                    command = U_SPIFFS;
-                    log_d("runUpdate spiffs...\n");
-                } else {
-                    command = U_FLASH;
-                    log_d("runUpdate flash...\n");
+                if(_rebootOnUpdate && !spiffs && !stagedPartition() && _sink == HTTP_UPDATE_SINK_FLASH) {
+                    ESP.restart();
                 }
 
-                if(!spiffs) {
-/* To do
-                    uint8_t buf[4];
-                    if(tcp->peekBytes(&buf[0], 4) != 4) {
-                        log_e("peekBytes magic header failed\n");
-                        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
-                        http.end();
-                        return HTTP_UPDATE_FAILED;
-                    }
-*/
-
-                    // check for valid first magic byte
-//                    if(buf[0] != 0xE9) {
-                    if(tcp->peek() != 0xE9) {
-                        log_e("Magic header does not start with 0xE9\n");
-                        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
-                        http.end();
-                        return HTTP_UPDATE_FAILED;
-
-                    }
-/* To do
-                    uint32_t bin_flash_size = ESP.magicFlashChipSize((buf[3] & 0xf0) >> 4);
-
-                    // check if new bin fits to SPI flash
-                    if(bin_flash_size > ESP.getFlashChipRealSize()) {
-                        log_e("New binary does not fit SPI Flash size\n");
-                        _lastError = HTTP_UE_BIN_FOR_WRONG_FLASH;
-                        http.end();
-                        return HTTP_UPDATE_FAILED;
-                    }
-*/
-                }
-                if(runUpdate(*tcp, len, http.header("x-MD5"), command)) {
-                    ret = HTTP_UPDATE_OK;
-                    log_d("Update ok\n");
-                    http.end();
-
-                    if(_rebootOnUpdate && !spiffs) {
-                        ESP.restart();
-                    }
-
-                } else {
-                    ret = HTTP_UPDATE_FAILED;
-                    log_e("Update failed\n");
-                }
+            } else {
+                log_e("Update failed\n");
             }
         } else {
             _lastError = HTTP_UE_SERVER_NOT_REPORT_SIZE;
             ret = HTTP_UPDATE_FAILED;
-            log_e("Content-Length was 0 or wasn't set by Server?!\n");
+            log_e("Content-Length was 0 or wasn't set by Server and body is not chunked?!\n");
         }
         break;
     case HTTP_CODE_NOT_MODIFIED:
@@ -385,10 +518,323 @@ HTTPUpdateResult HTTPUpdate::handleUpdate(HTTPClient& http, const String& curren
         break;
     }
 
+    if(ret == HTTP_UPDATE_FAILED) {
+        // the unread rest of the body would be taken as the next response on a kept alive connection
+        http.getStream().stop();
+    }
     http.end();
+    // the tags belong to this request only, a later update must not store them
+    _imageTag = String();
+    _responseTag = String();
     return ret;
 }
 
+/**
+ * check an image stream against the target partition and write it
+ * @param in Stream& response body (or any other source of the image)
+ * @param len uint32_t length of the stream
+ * @param md5 String md5 of the image (optional)
+ * @param spiffs bool
+ * @param decoded DecodeStream* set to &stream if its length is not known up front, len is ignored then
+ * @return HTTPUpdateResult
+ */
+HTTPUpdateResult HTTPUpdate::handleStream(Stream& stream, uint32_t len, const String& md5, bool spiffs, DecodeStream* decoded)
+{
+    _stageStart = millis();
+    if(decoded) {
+        // nothing to check before the end of the stream, Update stops at the end of the partition
+        len = 0;
+    }
+
+    if(spiffs) {
+        const esp_partition_t* _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+        if(!_partition){
+            _lastError = HTTP_UE_NO_PARTITION;
+            return HTTP_UPDATE_FAILED;
+        }
+
+        if(len > _partition->size) {
+            log_e("spiffsSize to low (%d) needed: %d\n", _partition->size, len);
+            _lastError = HTTP_UE_TOO_LESS_SPACE;
+            return HTTP_UPDATE_FAILED;
+        }
+    } else {
+        uint32_t sketchFreeSpace = ESP.getFreeSketchSpace();
+        if(!sketchFreeSpace){
+            _lastError = HTTP_UE_NO_PARTITION;
+            return HTTP_UPDATE_FAILED;
+        }
+
+        // a bundle also carries data partitions, each segment is checked against its own partition
+        if(len > sketchFreeSpace && stream.peek() != HTTP_UPDATE_BUNDLE_MAGIC[0]) {
+            log_e("FreeSketchSpace to low (%d) needed: %d\n", sketchFreeSpace, len);
+            _lastError = HTTP_UE_TOO_LESS_SPACE;
+            return HTTP_UPDATE_FAILED;
+        }
+    }
+
+// To do?    WiFiUDP::stopAll();
+// To do?    WiFiClient::stopAllExcept(tcp);
+
+    // compressed images are inflated between the network and Update
+    Stream * in = &stream;
+    GzipStream gzip(stream, decoded ? 0 : len);
+    bool compressed = (stream.peek() == GZIP_MAGIC_0);
+    if(compressed) {
+        log_d("gzip compressed image\n");
+        if(!gzip.begin()) {
+            _lastError = HTTP_UE_DECOMPRESS_FAILED;
+            return HTTP_UPDATE_FAILED;
+        }
+        in = &gzip;
+    }
+
+    int command;
+    bool delta = false;
+    bool bundle = false;
+
+    if(spiffs) {
+        command = U_SPIFFS;
+        log_d("runUpdate spiffs...\n");
+    } else {
+        command = U_FLASH;
+        log_d("runUpdate flash...\n");
+    }
+
+    if(!spiffs) {
+/* To do
+        uint8_t buf[4];
+        if(tcp->peekBytes(&buf[0], 4) != 4) {
+            log_e("peekBytes magic header failed\n");
+            _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+            return HTTP_UPDATE_FAILED;
+        }
+*/
+
+        // check for valid first magic byte
+//        if(buf[0] != 0xE9) {
+        int magic = in->peek();
+        if(_deltaUpdate && magic == HTTP_UPDATE_DELTA_MAGIC[0]) {
+            log_d("runUpdate delta...\n");
+            delta = true;
+        } else if(magic == HTTP_UPDATE_BUNDLE_MAGIC[0]) {
+            log_d("runUpdate bundle...\n");
+            bundle = true;
+        } else if(magic != 0xE9) {
+            log_e("Magic header does not start with 0xE9\n");
+            _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+            return HTTP_UPDATE_FAILED;
+
+        }
+        // the rest of the header is checked by copyStream before the first sector is written
+    }
+
+    // whatever was staged is overwritten from here on
+    if(_sink == HTTP_UPDATE_SINK_FLASH && !spiffs && stagedPartition()) {
+        storeStagedPartition(NULL);
+    }
+
+    bool updated;
+    if(_sink != HTTP_UPDATE_SINK_FLASH) {
+        // gzip is still inflated so its cost shows up, delta and bundle streams are only hashed
+        updated = runDryRun(*in, (compressed || decoded) ? UPDATE_SIZE_UNKNOWN : len, md5, compressed ? &gzip : decoded, decoded);
+    } else if(bundle) {
+        updated = runBundleUpdate(*in, decoded);
+    } else if(delta) {
+        updated = runDeltaUpdate(*in, (compressed || decoded) ? UPDATE_SIZE_UNKNOWN : len, md5, compressed ? &gzip : decoded,
+                                 decoded);
+    } else if(compressed) {
+        // the transfer decoding around the gzip stream must end cleanly too
+        updated = runUpdate(gzip, md5, command, decoded);
+    } else if(decoded) {
+        updated = runUpdate(*decoded, md5, command);
+    } else {
+        updated = runUpdate(stream, len, md5, command);
+    }
+    if(updated && !spiffs && _sink == HTTP_UPDATE_SINK_FLASH) {
+        stageDone();
+    }
+    if(!updated && (_abortRequested || _progressAborted)) {
+        // the stream only saw a short read, the reason is the abort
+        _lastError = HTTP_UE_ABORTED;
+    }
+    return updated ? HTTP_UPDATE_OK : HTTP_UPDATE_FAILED;
+}
+
+/**
+ * note the time an image took to reach flash and, in stage only mode,
+ * switch the boot partition back to the running image
+ */
+void HTTPUpdate::stageDone(void)
+{
+    _stageTime = millis() - _stageStart;
+
+    // Update.end() already verified the image and made it the boot partition
+    const esp_partition_t* staged = esp_ota_get_boot_partition();
+    storePartitionTag(staged, _responseTag.length() ? _responseTag : _imageTag);
+    _responseTag = String();
+    _imageTag = String();
+    if(!_stageOnly) {
+        return;
+    }
+
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    if(!staged || staged == running || esp_ota_set_boot_partition(running) != ESP_OK) {
+        log_e("keeping the running image as boot partition failed, update is active\n");
+        return;
+    }
+    // kept in NVS, a reboot before the maintenance window must not lose the staged image
+    storeStagedPartition(staged);
+    log_d("image staged in %s after %u ms\n", staged->label, _stageTime);
+}
+
+/**
+ * partition holding a staged image, read from NVS on first use
+ * @return const esp_partition_t* NULL if nothing is staged
+ */
+const esp_partition_t* HTTPUpdate::stagedPartition(void)
+{
+    if(_stagedLoaded) {
+        return _stagedPartition;
+    }
+    _stagedLoaded = true;
+    _stagedPartition = NULL;
+
+    Preferences prefs;
+    if(!prefs.begin("httpUpdate", true)) {
+        return NULL;
+    }
+    String label = prefs.getString("staged", String());
+    prefs.end();
+    if(!label.length()) {
+        return NULL;
+    }
+
+    const esp_partition_t* staged = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, label.c_str());
+    if(!staged || staged == esp_ota_get_running_partition()) {
+        // activated since, or the partition table changed
+        storeStagedPartition(NULL);
+        return NULL;
+    }
+    _stagedPartition = staged;
+    return staged;
+}
+
+/**
+ * remember the partition of a staged image across reboots
+ * @param partition const esp_partition_t* NULL forgets it
+ */
+void HTTPUpdate::storeStagedPartition(const esp_partition_t* partition)
+{
+    _stagedPartition = partition;
+    _stagedLoaded = true;
+
+    Preferences prefs;
+    if(!prefs.begin("httpUpdate", false)) {
+        return;
+    }
+    if(partition) {
+        prefs.putString("staged", partition->label);
+    } else {
+        prefs.remove("staged");
+    }
+    prefs.end();
+}
+
+/**
+ * entity tag stored for the image in a partition
+ * @param partition const esp_partition_t* (may be NULL)
+ * @return String tag, empty if none is known
+ */
+String HTTPUpdate::partitionTag(const esp_partition_t* partition)
+{
+    if(!partition) {
+        return String();
+    }
+    Preferences prefs;
+    if(!prefs.begin("httpUpdate", true)) {
+        return String();
+    }
+    String tag = prefs.getString(partition->label, String());
+    prefs.end();
+    return tag;
+}
+
+/**
+ * remember the entity tag of the image just written to a partition
+ * @param partition const esp_partition_t*
+ * @param tag const String& empty forgets the old tag
+ */
+void HTTPUpdate::storePartitionTag(const esp_partition_t* partition, const String& tag)
+{
+    Preferences prefs;
+    if(!partition || !prefs.begin("httpUpdate", false)) {
+        return;
+    }
+    if(tag.length()) {
+        prefs.putString(partition->label, tag);
+    } else {
+        prefs.remove(partition->label);
+    }
+    prefs.end();
+}
+
+String HTTPUpdate::getInstalledTag(void)
+{
+    return partitionTag(esp_ota_get_running_partition());
+}
+
+bool HTTPUpdate::isInstalled(const String& tag)
+{
+    if(!tag.length()) {
+        return false;
+    }
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    const esp_partition_t* boot = esp_ota_get_boot_partition();
+    String bootTag = (boot != running) ? partitionTag(boot) : String();
+    return imageState(tag.c_str(), partitionTag(running).c_str(), bootTag.c_str(),
+            partitionTag(stagedPartition()).c_str()) != IMAGE_UNKNOWN;
+}
+
+/**
+ * make the staged image the boot partition
+ * @param reboot bool restart into it right away
+ * @return false if there is no staged image or it no longer verifies
+ */
+bool HTTPUpdate::activateUpdate(bool reboot)
+{
+    const esp_partition_t* staged = stagedPartition();
+    if(!staged) {
+        _lastError = HTTP_UE_NOT_STAGED;
+        return false;
+    }
+
+    unsigned long start = millis();
+    esp_err_t err = esp_ota_set_boot_partition(staged);
+    storeStagedPartition(NULL);
+    if(err != ESP_OK) {
+        log_e("activating staged image failed (%d)\n", err);
+        _lastError = HTTP_UE_ACTIVATE_FAILED;
+        return false;
+    }
+
+    if(reboot) {
+        activationRecord.magic = ACTIVATION_MAGIC;
+        activationRecord.elapsed = millis() - start;
+        ESP.restart();
+    }
+    return true;
+}
+
+uint32_t HTTPUpdate::getActivationTime(void)
+{
+    if(activationRecord.magic != ACTIVATION_MAGIC) {
+        return 0;
+    }
+    activationRecord.magic = 0;
+    return activationRecord.elapsed + millis();
+}
+
 /**
  * write Update to flash
  * @param in Stream&
@@ -411,6 +857,7 @@ bool HTTPUpdate::runUpdate(Stream& in, uint32_t size, String md5, int command)
 
     if(md5.length()) {
         if(!Update.setMD5(md5.c_str())) {
+            Update.abort();
             _lastError = HTTP_UE_SERVER_FAULTY_MD5;
             log_e("Update.setMD5 failed! (%s)\n", md5.c_str());
             return false;
@@ -419,11 +866,19 @@ bool HTTPUpdate::runUpdate(Stream& in, uint32_t size, String md5, int command)
 
 // To do: the SHA256 could be checked if the server sends it
 
-    if(Update.writeStream(in) != size) {
-        _lastError = Update.getError();
-        Update.printError(error);
-        error.trim(); // remove line ending
-        log_e("Update.writeStream failed! (%s)\n", error.c_str());
+    progressBegin(size);
+    if(copyStream(in, size, command == U_FLASH) != size) {
+        if(!_copyError && Update.hasError()) {
+            _lastError = Update.getError();
+            Update.printError(error);
+            error.trim(); // remove line ending
+            log_e("Update write failed! (%s)\n", error.c_str());
+        } else if(!_copyError) {
+            // Update itself is fine, the stream stopped before size bytes
+            _lastError = HTTP_UE_STREAM_ENDED;
+            log_e("stream ended after %u of %u bytes\n", Update.progress(), size);
+        }
+        Update.abort();
         return false;
     }
 
@@ -438,6 +893,949 @@ bool HTTPUpdate::runUpdate(Stream& in, uint32_t size, String md5, int command)
     return true;
 }
 
+/**
+ * copy a stream into the running Update in whole flash sectors
+ * @param in Stream&
+ * @param size uint32_t bytes to copy, UPDATE_SIZE_UNKNOWN copies until the stream ends
+ * @param preflight bool check the app image header before the first sector is written
+ * @return bytes written
+ */
+uint32_t HTTPUpdate::copyStream(Stream& in, uint32_t size, bool preflight)
+{
+    SectorWriter writer;
+    uint32_t copied = 0;
+
+    _copyError = 0;
+
+    _copyStats.reads = 0;
+    _copyStats.writes = 0;
+    _copyStats.bytes = 0;
+    memset(&_timings, 0, sizeof(_timings));
+    uint32_t started = micros();
+
+    if(!writer.begin(_doubleBuffer)) {
+        log_e("no memory for the sector buffer\n");
+        _lastError = HTTP_UE_NO_MEMORY;
+        _copyError = _lastError;
+        _progressActive = false;
+        Update.abort();
+        return 0;
+    }
+
+    if(_ledPin != -1) {
+        pinMode(_ledPin, OUTPUT);
+    }
+
+    while(copied < size) {
+        size_t room;
+        uint8_t * buf = writer.space(room);
+        if(size != UPDATE_SIZE_UNKNOWN && room > size - copied) {
+            room = size - copied;
+        }
+        size_t space = room;
+
+        if(_ledPin != -1) {
+            digitalWrite(_ledPin, _ledOn); // Switch LED on
+        }
+        room = bandwidthAllow(room);
+        uint32_t t = micros();
+        size_t n = in.readBytes((char *) buf, room);
+        _copyStats.reads++;
+        if(n == 0 && size != UPDATE_SIZE_UNKNOWN) {
+            // give a slow server one more chance like Update.writeStream does
+            delay(100);
+            n = in.readBytes((char *) buf, room);
+            _copyStats.reads++;
+        }
+        _timings.receive += micros() - t;
+        bandwidthUse(n);
+        if(_ledPin != -1) {
+            digitalWrite(_ledPin, !_ledOn); // Switch LED off
+        }
+
+        // nothing is erased before the first sector goes out, so a wrong image costs no flash
+        if(preflight && copied == 0 && n > 0) {
+            // the check needs the whole header at once, the bandwidth limit applies from the next read
+            size_t want = (space < HTTP_UPDATE_PREFLIGHT_SIZE) ? space : HTTP_UPDATE_PREFLIGHT_SIZE;
+            while(n < want) {
+                size_t more = in.readBytes((char *) buf + n, want - n);
+                if(more == 0) {
+                    break;
+                }
+                bandwidthUse(more);
+                n += more;
+            }
+            // only the end of a stream of unknown length may cut it short
+            bool cut = (n < want && size != UPDATE_SIZE_UNKNOWN);
+            if(cut) {
+                log_e("image header cut short after %u bytes\n", n);
+                _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+            }
+            if(cut || !checkImage(buf, n)) {
+                _copyError = _lastError;
+                _progressActive = false;
+                writer.abort();
+                return 0;
+            }
+        }
+
+        t = micros();
+        bool committed = (n > 0) && writer.commit(n);
+        _timings.write += micros() - t;
+        if(!committed) {
+            break;
+        }
+        copied += n;
+
+        if(!progressUpdate(copied)) {
+            _lastError = HTTP_UE_ABORTED;
+            _copyError = _lastError;
+            log_e("update aborted after %u bytes\n", copied);
+            _progressActive = false;
+            writer.abort();
+            return 0;
+        }
+    }
+
+    uint32_t t = micros();
+    bool ok = writer.end();
+    _timings.write += micros() - t;
+    _timings.bytes = copied;
+    _timings.total = micros() - started;
+    progressEnd();
+    _copyStats.writes = writer.writes();
+    _copyStats.bytes = copied;
+    log_d("copied %u bytes in %u reads and %u writes\n", copied, _copyStats.reads, _copyStats.writes);
+    return ok ? copied : 0;
+}
+
+/**
+ * download and hash an image without writing flash
+ * @param in Stream&
+ * @param size uint32_t bytes to read, UPDATE_SIZE_UNKNOWN reads until the stream ends
+ * @param md5 String md5 to check against (optional)
+ * @param decoded DecodeStream* must report finished() at the end if given
+ * @param body DecodeStream* transfer decoding of the response body (optional)
+ * @return true if the whole image arrived and matched md5
+ */
+bool HTTPUpdate::runDryRun(Stream& in, uint32_t size, const String& md5, DecodeStream* decoded, DecodeStream* body)
+{
+    uint8_t* buf = (uint8_t*) malloc(SPI_FLASH_SEC_SIZE);
+    uint8_t* sink = (_sink == HTTP_UPDATE_SINK_RAM) ? (uint8_t*) malloc(HTTP_UPDATE_RAM_SINK_SIZE) : NULL;
+    if(!buf || (_sink == HTTP_UPDATE_SINK_RAM && !sink)) {
+        free(buf);
+        free(sink);
+        _lastError = HTTP_UE_TOO_LESS_SPACE;
+        return false;
+    }
+
+    // the model sees the same coalesced sector writes as flash would
+    SectorWriter writer;
+    if(_sink == HTTP_UPDATE_SINK_MODEL && (!_flashModel || !_flashModel->begin(size == UPDATE_SIZE_UNKNOWN ? 0 : size)
+            || !writer.begin(_doubleBuffer, _flashModel))) {
+        free(buf);
+        _lastError = HTTP_UE_NO_PARTITION;
+        return false;
+    }
+
+    memset(&_timings, 0, sizeof(_timings));
+    uint32_t started = micros();
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    MD5Builder md5Builder;
+    md5Builder.begin();
+
+    progressBegin(size);
+    uint32_t copied = 0;
+    size_t sinkPos = 0;
+    bool ok = true;
+    while(copied < size) {
+        size_t want = SPI_FLASH_SEC_SIZE;
+        if(size != UPDATE_SIZE_UNKNOWN && want > size - copied) {
+            want = size - copied;
+        }
+        uint32_t t = micros();
+        size_t n = in.readBytes((char *) buf, bandwidthAllow(want));
+        _timings.receive += micros() - t;
+        bandwidthUse(n);
+        if(n == 0) {
+            break;
+        }
+
+        t = micros();
+        mbedtls_sha256_update_ret(&ctx, buf, n);
+        if(md5.length()) {
+            md5Builder.add(buf, n);
+        }
+        _timings.hash += micros() - t;
+
+        if(sink) {
+            // a ring, the point is the cost of moving the bytes, not keeping them
+            t = micros();
+            for(size_t done = 0; done < n;) {
+                size_t part = HTTP_UPDATE_RAM_SINK_SIZE - sinkPos;
+                if(part > n - done) {
+                    part = n - done;
+                }
+                memcpy(sink + sinkPos, buf + done, part);
+                sinkPos = (sinkPos + part) % HTTP_UPDATE_RAM_SINK_SIZE;
+                done += part;
+            }
+            _timings.write += micros() - t;
+        } else if(_sink == HTTP_UPDATE_SINK_MODEL) {
+            t = micros();
+            bool written = writer.write(buf, n);
+            _timings.write += micros() - t;
+            if(!written) {
+                _lastError = HTTP_UE_TOO_LESS_SPACE;
+                ok = false;
+                break;
+            }
+        }
+
+        copied += n;
+        if(!progressUpdate(copied)) {
+            _lastError = HTTP_UE_ABORTED;
+            ok = false;
+            break;
+        }
+    }
+
+    if(_sink == HTTP_UPDATE_SINK_MODEL) {
+        uint32_t t = micros();
+        writer.end();
+        _timings.write += micros() - t;
+        log_i("flash model: %u erases (max %u per sector), %u page programs, %u ms busy\n", _flashModel->erases(),
+              _flashModel->maxErases(), _flashModel->pagePrograms(), _flashModel->busyTime() / 1000);
+    }
+    mbedtls_sha256_finish_ret(&ctx, _timings.sha256);
+    mbedtls_sha256_free(&ctx);
+    free(buf);
+    free(sink);
+    _timings.bytes = copied;
+    _timings.total = micros() - started;
+    _progressActive = ok && _progressActive;
+    progressEnd();
+
+    if(ok && ((size != UPDATE_SIZE_UNKNOWN && copied != size) || (decoded && !decoded->finished()) || !bodyFinished(body))) {
+        log_e("dry run ended early after %u bytes\n", copied);
+        _lastError = HTTP_UE_DECOMPRESS_FAILED;
+        ok = false;
+    }
+    if(ok && md5.length()) {
+        md5Builder.calculate();
+        if(!md5.equalsIgnoreCase(md5Builder.toString())) {
+            log_e("dry run MD5 mismatch\n");
+            _lastError = HTTP_UE_SERVER_FAULTY_MD5;
+            ok = false;
+        }
+    }
+    log_i("dry run: %u bytes in %u ms, receive %u ms, hash %u ms, write %u ms\n", copied, _timings.total / 1000,
+          _timings.receive / 1000, _timings.hash / 1000, _timings.write / 1000);
+    return ok;
+}
+
+/**
+ * check the start of an app image against this device
+ * @param data const uint8_t* first bytes of the image
+ * @param len size_t at least the image header, ideally HTTP_UPDATE_PREFLIGHT_SIZE
+ * @return false and _lastError set if the image can not run here
+ */
+bool HTTPUpdate::checkImage(const uint8_t* data, size_t len)
+{
+    memset(&_imageInfo, 0, sizeof(_imageInfo));
+    if(len < 24 || data[0] != 0xE9 || data[1] == 0 || data[1] > 16) {
+        log_e("image header invalid\n");
+        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+        return false;
+    }
+
+    // image header: magic, segment count, spi mode, spi speed/size, entry, wp pin, drive settings, chip id
+    _imageInfo.flashSize = ESP.magicFlashChipSize((data[3] & 0xf0) >> 4);
+    _imageInfo.chipId = data[12] | (data[13] << 8);
+    if(_imageInfo.flashSize > ESP.getFlashChipSize()) {
+        log_e("New binary needs %u bytes of flash, %u available\n", _imageInfo.flashSize, ESP.getFlashChipSize());
+        _lastError = HTTP_UE_BIN_FOR_WRONG_FLASH;
+        return false;
+    }
+    // the ESP32 is 0, older tool versions left the field zero on every chip
+    if(_imageInfo.chipId != CONFIG_IDF_FIRMWARE_CHIP_ID) {
+        log_e("New binary is for chip id %u\n", _imageInfo.chipId);
+        _lastError = HTTP_UE_BIN_FOR_WRONG_CHIP;
+        return false;
+    }
+
+    // the app descriptor opens the first segment, after its 8 byte header
+    const uint8_t* desc = data + 24 + 8;
+    uint32_t descMagic = 0;
+    if(len >= HTTP_UPDATE_PREFLIGHT_SIZE) {
+        memcpy(&descMagic, desc, sizeof(descMagic));
+    }
+    if(descMagic != 0xABCD5432) {
+        log_d("image has no app descriptor\n");
+        if(_projectName.length()) {
+            _lastError = HTTP_UE_BIN_FOR_WRONG_PROJECT;
+            return false;
+        }
+        return true;
+    }
+    memcpy(_imageInfo.version, desc + 16, 32);
+    memcpy(_imageInfo.projectName, desc + 48, 32);
+    memcpy(_imageInfo.idfVersion, desc + 112, 32);
+    log_d("image %s %s, IDF %s\n", _imageInfo.projectName, _imageInfo.version, _imageInfo.idfVersion);
+
+    if(_projectName.length() && _projectName != _imageInfo.projectName) {
+        log_e("New binary is for project %s\n", _imageInfo.projectName);
+        _lastError = HTTP_UE_BIN_FOR_WRONG_PROJECT;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * start a new progress measurement
+ * @param total uint32_t image size, 0 if unknown
+ */
+void HTTPUpdate::progressBegin(uint32_t total)
+{
+    unsigned long now = millis();
+    portENTER_CRITICAL(&_progressMux);
+    _progress.done = 0;
+    _progress.total = (total == UPDATE_SIZE_UNKNOWN) ? 0 : total;
+    _progress.rate = 0;
+    _progress.smoothedRate = 0;
+    _progress.eta = 0;
+    _progress.stalled = 0;
+    _progressLastByte = now;
+    _progressActive = true;
+    portEXIT_CRITICAL(&_progressMux);
+    _progressStart = now;
+    _progressSample = now;
+    _progressSampleBytes = 0;
+    _progressAborted = false;
+    _bucketTokens = 0;
+    _bucketTime = now;
+    // the application was busy when it started the update
+    _lastActivity = now;
+}
+
+/**
+ * report the final sample of the measurement
+ */
+void HTTPUpdate::progressEnd(void)
+{
+    if(_progressActive) {
+        progressUpdate(_progress.done, true);
+        _progressActive = false;
+    }
+}
+
+HTTPUpdateProgress HTTPUpdate::getProgress(void)
+{
+    portENTER_CRITICAL(&_progressMux);
+    HTTPUpdateProgress progress = _progress;
+    bool active = _progressActive;
+    unsigned long lastByte = _progressLastByte;
+    portEXIT_CRITICAL(&_progressMux);
+    if(active) {
+        // a blocked read does not update the sample, so age the stall here
+        progress.stalled = millis() - lastByte;
+    }
+    return progress;
+}
+
+/**
+ * record the bytes written so far and report them
+ * @param done uint32_t bytes written
+ * @param force bool report even if the last sample is recent
+ * @return false if the callback or abort() asked to stop
+ */
+bool HTTPUpdate::progressUpdate(uint32_t done, bool force)
+{
+    if(_abortRequested) {
+        _progressAborted = true;
+        return false;
+    }
+
+    // only this task writes _progress, the lock is for getProgress
+    unsigned long now = millis();
+    HTTPUpdateProgress progress = _progress;
+    unsigned long lastByte = (done != progress.done) ? now : _progressLastByte;
+    progress.done = done;
+    progress.stalled = now - lastByte;
+
+    unsigned long elapsed = now - _progressSample;
+    bool sample = force || elapsed >= HTTP_UPDATE_PROGRESS_INTERVAL;
+    if(sample) {
+        if(elapsed > 0) {
+            progress.rate = (uint64_t) (done - _progressSampleBytes) * 1000 / elapsed;
+            // the first sample seeds the average, later ones move it by 1/8
+            if(_progressSample == _progressStart) {
+                progress.smoothedRate = progress.rate;
+            } else {
+                progress.smoothedRate = (progress.smoothedRate * 7 + progress.rate) / 8;
+            }
+        }
+        _progressSample = now;
+        _progressSampleBytes = done;
+
+        if(progress.total > done && progress.smoothedRate > 0) {
+            progress.eta = (progress.total - done) / progress.smoothedRate;
+        } else {
+            progress.eta = 0;
+        }
+    }
+
+    portENTER_CRITICAL(&_progressMux);
+    _progress = progress;
+    _progressLastByte = lastByte;
+    portEXIT_CRITICAL(&_progressMux);
+
+    if(sample && _progressCallback && !_progressCallback(progress)) {
+        _progressAborted = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * called by the network stages while they wait for data, so a stall is
+ * sampled like progress and an abort does not wait for the read timeout
+ * @return false if the update should stop
+ */
+bool HTTPUpdate::progressTick(void)
+{
+    if(_abortRequested || _progressAborted) {
+        return false;
+    }
+    return !_progressActive || progressUpdate(_progress.done);
+}
+
+/**
+ * wait for the token bucket to allow reading
+ * @param want size_t bytes the caller would like to read
+ * @return bytes that may be read now, at least 1 if want is not 0
+ */
+size_t HTTPUpdate::bandwidthAllow(size_t want)
+{
+    while(want > 0) {
+        uint32_t limit = (millis() - _lastActivity > HTTP_UPDATE_IDLE_TIMEOUT) ? _idleBandwidthLimit : _bandwidthLimit;
+        if(limit == 0) {
+            return want;
+        }
+
+        // refill, a quarter second of tokens at most so a lifted limit does not burst
+        uint32_t burst = (limit / 4 > 512) ? limit / 4 : 512;
+        unsigned long now = millis();
+        uint64_t refill = (uint64_t) (now - _bucketTime) * limit / 1000;
+        if(refill > 0) {
+            _bucketTokens = (refill + _bucketTokens > burst) ? burst : _bucketTokens + refill;
+            _bucketTime = now;
+        }
+        if(_bucketTokens > 0) {
+            return (want > _bucketTokens) ? _bucketTokens : want;
+        }
+
+        // short naps so a changed limit is picked up quickly
+        uint32_t wait = 1000 / limit + 1;
+        delay(wait > 100 ? 100 : wait);
+    }
+    return want;
+}
+
+/**
+ * take the bytes actually read from the token bucket
+ * @param used size_t
+ */
+void HTTPUpdate::bandwidthUse(size_t used)
+{
+    _bucketTokens = (used > _bucketTokens) ? 0 : _bucketTokens - used;
+}
+
+typedef struct {
+    HTTPUpdate* updater;
+    HTTPUpdateJob job;
+    HTTPUpdateDoneCallback done;
+} background_job_t;
+
+void HTTPUpdate::backgroundTask(void* arg)
+{
+    background_job_t* bg = (background_job_t*) arg;
+    HTTPUpdateResult ret = bg->job();
+    if(bg->done) {
+        bg->done(ret);
+    }
+    bg->updater->_backgroundRunning = false;
+    delete bg;
+    vTaskDelete(NULL);
+}
+
+/**
+ * run an update in a task of its own so the caller keeps serving the application
+ * @param job HTTPUpdateJob the update call to make
+ * @param done HTTPUpdateDoneCallback called from the task with the result (optional)
+ * @param priority UBaseType_t task priority, keep it below the application tasks
+ * @return false if an update is already running or the task could not be created
+ */
+bool HTTPUpdate::runInBackground(HTTPUpdateJob job, HTTPUpdateDoneCallback done, UBaseType_t priority)
+{
+    if(_backgroundRunning || !job) {
+        return false;
+    }
+    background_job_t* bg = new background_job_t { this, job, done };
+    _backgroundRunning = true;
+    if(xTaskCreate(backgroundTask, "httpUpdate", HTTP_UPDATE_BACKGROUND_STACK, bg, priority, NULL) != pdPASS) {
+        log_e("creating update task failed\n");
+        _backgroundRunning = false;
+        delete bg;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * write a decoded Update of unknown length to flash
+ * @param in DecodeStream&
+ * @param md5 String md5 of the decoded image (optional)
+ * @param body DecodeStream* transfer decoding below in that must end as well (optional)
+ * @return true if Update ok
+ */
+bool HTTPUpdate::runUpdate(DecodeStream& in, String md5, int command, DecodeStream* body)
+{
+
+    StreamString error;
+
+    if(!Update.begin(UPDATE_SIZE_UNKNOWN, command, _ledPin, _ledOn)) {
+        _lastError = Update.getError();
+        Update.printError(error);
+        error.trim(); // remove line ending
+        log_e("Update.begin failed! (%s)\n", error.c_str());
+        return false;
+    }
+
+    if(md5.length()) {
+        if(!Update.setMD5(md5.c_str())) {
+            Update.abort();
+            _lastError = HTTP_UE_SERVER_FAULTY_MD5;
+            log_e("Update.setMD5 failed! (%s)\n", md5.c_str());
+            return false;
+        }
+    }
+
+    progressBegin(0);
+    copyStream(in, UPDATE_SIZE_UNKNOWN, command == U_FLASH);
+    if(_copyError) {
+        Update.abort();
+        return false;
+    }
+    if(Update.hasError()) {
+        _lastError = Update.getError();
+        Update.printError(error);
+        error.trim(); // remove line ending
+        log_e("Update write failed! (%s)\n", error.c_str());
+        return false;
+    }
+
+    // the decoder checks its own trailer, only a clean end may be committed
+    if(!in.finished() || !bodyFinished(body)) {
+        Update.abort();
+        _lastError = HTTP_UE_DECOMPRESS_FAILED;
+        log_e("decoded stream ended early after %u bytes\n", Update.progress());
+        return false;
+    }
+
+    if(!Update.end(true)) {
+        _lastError = Update.getError();
+        Update.printError(error);
+        error.trim(); // remove line ending
+        log_e("Update.end failed! (%s)\n", error.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * a stage on top of a decoding stops at its own end, the zero length
+ * chunk or gzip trailer after it must still arrive
+ * @param body DecodeStream* decoding stage (may be NULL)
+ * @return true if there is no decoding or it ended cleanly
+ */
+bool HTTPUpdate::bodyFinished(DecodeStream* body)
+{
+    if(body && !body->ended()) {
+        log_e("body did not end cleanly after the image\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * rebuild the new image from a delta patch and the running partition
+ * @param in Stream& patch stream
+ * @param size uint32_t patch size
+ * @param md5 String md5 of the new image (optional)
+ * @param decoded DecodeStream* decoding stage in reads from, read to its end after the patch (optional)
+ * @param body DecodeStream* transfer decoding below in that must end as well (optional)
+ * @return true if Update ok
+ */
+bool HTTPUpdate::runDeltaUpdate(Stream& in, uint32_t size, String md5, DecodeStream* decoded, DecodeStream* body)
+{
+    StreamString error;
+    delta_header_t header;
+
+    if(size < sizeof(header) || in.readBytes((char *) &header, sizeof(header)) != sizeof(header)
+            || memcmp(header.magic, HTTP_UPDATE_DELTA_MAGIC, sizeof(header.magic)) != 0) {
+        _lastError = HTTP_UE_DELTA_PATCH_CORRUPT;
+        log_e("delta header invalid\n");
+        return false;
+    }
+
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    if(!running) {
+        _lastError = HTTP_UE_NO_PARTITION;
+        return false;
+    }
+    if(header.oldSize == 0 || header.oldSize > running->size) {
+        _lastError = HTTP_UE_DELTA_BASE_MISMATCH;
+        log_e("delta base size %u does not fit running partition\n", header.oldSize);
+        return false;
+    }
+
+    // read the running image through the cache instead of copying it to RAM
+    const uint8_t* old = NULL;
+    spi_flash_mmap_handle_t oldHandle;
+    if(esp_partition_mmap(running, 0, header.oldSize, ESP_PARTITION_MMAP_DATA, (const void **) &old, &oldHandle) != ESP_OK) {
+        _lastError = HTTP_UE_NO_PARTITION;
+        log_e("mmap of running partition failed\n");
+        return false;
+    }
+
+    uint8_t sha256[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+    mbedtls_sha256_update_ret(&ctx, old, header.oldSize);
+    mbedtls_sha256_finish_ret(&ctx, sha256);
+    if(memcmp(sha256, header.oldSha256, sizeof(sha256)) != 0) {
+        mbedtls_sha256_free(&ctx);
+        spi_flash_munmap(oldHandle);
+        _lastError = HTTP_UE_DELTA_BASE_MISMATCH;
+        log_e("delta base hash does not match running image\n");
+        return false;
+    }
+
+    if(!Update.begin(header.newSize, U_FLASH, _ledPin, _ledOn)) {
+        mbedtls_sha256_free(&ctx);
+        spi_flash_munmap(oldHandle);
+        _lastError = Update.getError();
+        Update.printError(error);
+        error.trim(); // remove line ending
+        log_e("Update.begin failed! (%s)\n", error.c_str());
+        return false;
+    }
+
+    if(md5.length()) {
+        if(!Update.setMD5(md5.c_str())) {
+            mbedtls_sha256_free(&ctx);
+            spi_flash_munmap(oldHandle);
+            Update.abort();
+            _lastError = HTTP_UE_SERVER_FAULTY_MD5;
+            log_e("Update.setMD5 failed! (%s)\n", md5.c_str());
+            return false;
+        }
+    }
+
+    mbedtls_sha256_starts_ret(&ctx, 0);
+
+    progressBegin(header.newSize);
+    SectorWriter writer;
+    DeltaPatch patch(old, header.oldSize, header.newSize);
+    uint8_t buf[512];
+    // the image header is only known once it is rebuilt, it is checked before its sector is written
+    uint8_t head[HTTP_UPDATE_PREFLIGHT_SIZE];
+    size_t headLen = 0;
+    bool ok = writer.begin(_doubleBuffer);
+    if(!ok) {
+        log_e("no memory for the sector buffer\n");
+        _lastError = HTTP_UE_NO_MEMORY;
+    }
+
+    while(ok && !patch.finished()) {
+        delta_control_t control;
+        if(in.readBytes((char *) &control, sizeof(control)) != sizeof(control) || !patch.control(control)) {
+            _lastError = HTTP_UE_DELTA_PATCH_CORRUPT;
+            ok = false;
+            break;
+        }
+
+        while(patch.pending() > 0) {
+            size_t n = bandwidthAllow((patch.pending() > sizeof(buf)) ? sizeof(buf) : patch.pending());
+            bandwidthUse(n);
+            if(in.readBytes((char *) buf, n) != n) {
+                _lastError = HTTP_UE_DELTA_PATCH_CORRUPT;
+                ok = false;
+                break;
+            }
+            patch.apply(buf, n);
+            if(headLen < sizeof(head)) {
+                size_t take = (n > sizeof(head) - headLen) ? sizeof(head) - headLen : n;
+                memcpy(head + headLen, buf, take);
+                headLen += take;
+                if((headLen == sizeof(head) || headLen == header.newSize) && !checkImage(head, headLen)) {
+                    ok = false;
+                    break;
+                }
+            }
+            mbedtls_sha256_update_ret(&ctx, buf, n);
+            if(!writer.write(buf, n)) {
+                _lastError = Update.getError();
+                ok = false;
+                break;
+            }
+            if(!progressUpdate(patch.written())) {
+                _lastError = HTTP_UE_ABORTED;
+                ok = false;
+                break;
+            }
+        }
+
+        if(ok && !patch.seek()) {
+            _lastError = HTTP_UE_DELTA_PATCH_CORRUPT;
+            ok = false;
+        }
+    }
+
+    if(!writer.end() && ok) {
+        _lastError = Update.getError();
+        ok = false;
+    }
+    _progressActive = ok && _progressActive;
+    progressEnd();
+    mbedtls_sha256_finish_ret(&ctx, sha256);
+    mbedtls_sha256_free(&ctx);
+    spi_flash_munmap(oldHandle);
+
+    if(ok && memcmp(sha256, header.newSha256, sizeof(sha256)) != 0) {
+        _lastError = HTTP_UE_SERVER_FAULTY_SHA256;
+        ok = false;
+    }
+    // the patch ends with its last byte, the decoder below may still hold its trailer
+    if(ok && (!bodyFinished(decoded) || !bodyFinished(body))) {
+        _lastError = HTTP_UE_DELTA_PATCH_CORRUPT;
+        ok = false;
+    }
+
+    if(!ok) {
+        log_e("delta update failed (%d) after %u of %u bytes\n", _lastError, patch.written(), header.newSize);
+        Update.abort();
+        return false;
+    }
+
+    if(!Update.end()) {
+        _lastError = Update.getError();
+        Update.printError(error);
+        error.trim(); // remove line ending
+        log_e("Update.end failed! (%s)\n", error.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic[4];
+    uint8_t version;
+    uint8_t count;
+    uint16_t reserved;
+} bundle_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t size;
+    uint8_t sha256[32];
+    char label[16];
+} bundle_segment_t;
+
+String HTTPUpdate::partitionLabel(const char* base)
+{
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    if(running && running->subtype >= ESP_PARTITION_SUBTYPE_APP_OTA_0 && running->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_MAX) {
+        String label = String(base) + "_" + String(running->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0);
+        if(esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label.c_str())) {
+            return label;
+        }
+    }
+    return String(base);
+}
+
+/**
+ * write an app and the data partitions that belong to it from one stream
+ *
+ * everything goes to the inactive slot, the boot partition is switched
+ * once after the last segment verified, so either all of it or none of it runs
+ * @param in Stream& bundle stream
+ * @param body DecodeStream* transfer decoding below in that must end as well (optional)
+ * @return true if the bundle was written and made the boot image
+ */
+bool HTTPUpdate::runBundleUpdate(Stream& in, DecodeStream* body)
+{
+    bundle_header_t header;
+    bundle_segment_t segments[HTTP_UPDATE_BUNDLE_MAX_SEGMENTS];
+
+    if(in.readBytes((char *) &header, sizeof(header)) != sizeof(header)
+            || memcmp(header.magic, HTTP_UPDATE_BUNDLE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != 1 || header.count == 0 || header.count > HTTP_UPDATE_BUNDLE_MAX_SEGMENTS
+            || in.readBytes((char *) segments, header.count * sizeof(bundle_segment_t)) != header.count * sizeof(bundle_segment_t)) {
+        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+        log_e("bundle header invalid\n");
+        return false;
+    }
+
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    const esp_partition_t* app = esp_ota_get_next_update_partition(NULL);
+    if(!running || !app) {
+        _lastError = HTTP_UE_NO_PARTITION;
+        return false;
+    }
+    String slot = String(app->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_0);
+
+    // find every target before the first byte is written
+    const esp_partition_t* targets[HTTP_UPDATE_BUNDLE_MAX_SEGMENTS];
+    int apps = 0;
+    for(int i = 0; i < header.count; i++) {
+        if(segments[i].type == HTTP_UPDATE_BUNDLE_APP) {
+            targets[i] = app;
+            apps++;
+        } else if(segments[i].type == HTTP_UPDATE_BUNDLE_DATA) {
+            char label[sizeof(segments[i].label) + 1];
+            memcpy(label, segments[i].label, sizeof(segments[i].label));
+            label[sizeof(segments[i].label)] = 0;
+            targets[i] = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, (String(label) + "_" + slot).c_str());
+            if(!targets[i]) {
+                log_e("no partition %s_%s for bundle segment %d\n", label, slot.c_str(), i);
+                _lastError = HTTP_UE_NO_PARTITION;
+                return false;
+            }
+        } else {
+            targets[i] = NULL;
+        }
+        if(!targets[i] || segments[i].size > targets[i]->size) {
+            log_e("bundle segment %d does not fit\n", i);
+            _lastError = targets[i] ? HTTP_UE_TOO_LESS_SPACE : HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+            return false;
+        }
+    }
+    if(apps != 1) {
+        log_e("bundle has %d apps\n", apps);
+        _lastError = HTTP_UE_BIN_VERIFY_HEADER_FAILED;
+        return false;
+    }
+
+    for(int i = 0; i < header.count; i++) {
+        SegmentStream segment(in, segments[i].size);
+        bool ok;
+        if(segments[i].type == HTTP_UPDATE_BUNDLE_APP) {
+            ok = runUpdate(segment, String(), U_FLASH);
+            // Update.end() switched the boot partition, keep the running app until the bundle is complete
+            if(ok && esp_ota_set_boot_partition(running) != ESP_OK) {
+                // without its first sector the bootloader passes over the new app and starts the running one
+                log_e("boot partition not restored, invalidating the new app\n");
+                if(esp_partition_erase_range(app, 0, SPI_FLASH_SEC_SIZE) != ESP_OK) {
+                    log_e("erasing the new app failed\n");
+                }
+                _lastError = HTTP_UE_NO_PARTITION;
+                ok = false;
+            }
+        } else {
+            ok = writePartition(segment, targets[i], segments[i].size);
+        }
+        if(!ok) {
+            log_e("bundle segment %d failed (%d)\n", i, _lastError);
+            return false;
+        }
+        if(memcmp(segment.sha256(), segments[i].sha256, sizeof(segments[i].sha256)) != 0) {
+            log_e("bundle segment %d hash mismatch\n", i);
+            _lastError = HTTP_UE_SERVER_FAULTY_SHA256;
+            return false;
+        }
+        log_d("bundle segment %d: %u bytes to %s\n", i, segments[i].size, targets[i]->label);
+    }
+
+    if(!bodyFinished(body)) {
+        log_e("bundle body did not end cleanly\n");
+        _lastError = HTTP_UE_DECOMPRESS_FAILED;
+        return false;
+    }
+
+    // the one switch that activates app and data together
+    if(esp_ota_set_boot_partition(app) != ESP_OK) {
+        _lastError = HTTP_UE_ACTIVATE_FAILED;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * write a data segment into a partition, erasing sector by sector
+ * @param in SegmentStream&
+ * @param partition const esp_partition_t*
+ * @param size uint32_t segment size, the rest of the partition is erased
+ * @return true if written
+ */
+bool HTTPUpdate::writePartition(SegmentStream& in, const esp_partition_t* partition, uint32_t size)
+{
+    uint8_t* buf = (uint8_t*) malloc(SPI_FLASH_SEC_SIZE);
+    if(!buf) {
+        _lastError = HTTP_UE_TOO_LESS_SPACE;
+        return false;
+    }
+
+    progressBegin(size);
+    uint32_t offset = 0;
+    bool ok = true;
+    while(ok && offset < size) {
+        size_t want = (size - offset > SPI_FLASH_SEC_SIZE) ? SPI_FLASH_SEC_SIZE : size - offset;
+        size_t n = in.readBytes((char *) buf, bandwidthAllow(want));
+        bandwidthUse(n);
+        while(n > 0 && n < want) {
+            size_t more = in.readBytes((char *) buf + n, bandwidthAllow(want - n));
+            if(more == 0) {
+                break;
+            }
+            bandwidthUse(more);
+            n += more;
+        }
+        if(n != want) {
+            _lastError = HTTP_UE_DECOMPRESS_FAILED;
+            ok = false;
+        } else if(esp_partition_erase_range(partition, offset, SPI_FLASH_SEC_SIZE) != ESP_OK
+                || esp_partition_write(partition, offset, buf, n) != ESP_OK) {
+            _lastError = HTTP_UE_NO_PARTITION;
+            ok = false;
+        } else {
+            offset += n;
+            if(!progressUpdate(offset)) {
+                _lastError = HTTP_UE_ABORTED;
+                ok = false;
+            }
+        }
+    }
+    free(buf);
+
+    // leftovers of the old contents would confuse the file system or NVS
+    uint32_t end = (size + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+    if(ok && end < partition->size && esp_partition_erase_range(partition, end, partition->size - end) != ESP_OK) {
+        _lastError = HTTP_UE_NO_PARTITION;
+        ok = false;
+    }
+    _progressActive = ok && _progressActive;
+    progressEnd();
+    return ok;
+}
+
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
 HTTPUpdate httpUpdate;
 #endif
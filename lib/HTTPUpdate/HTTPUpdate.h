@@ -32,6 +32,15 @@
 #include <WiFiUdp.h>
 #include <HTTPClient.h>
 #include <Update.h>
+#include <esp_partition.h>
+#include "GzipStream.h"
+#include "RangeStream.h"
+#include "CarStream.h"
+#include "ChunkedStream.h"
+#include "WatchStream.h"
+#include "DigestStream.h"
+#include "SectorWriter.h"
+#include "SegmentStream.h"
 
 /// note we use HTTP client errors too so we start at 100
 #define HTTP_UE_TOO_LESS_SPACE              (-100)
@@ -43,6 +52,46 @@
 #define HTTP_UE_BIN_VERIFY_HEADER_FAILED    (-106)
 #define HTTP_UE_BIN_FOR_WRONG_FLASH         (-107)
 #define HTTP_UE_NO_PARTITION                (-108)
+#define HTTP_UE_DELTA_BASE_MISMATCH         (-109)
+#define HTTP_UE_DELTA_PATCH_CORRUPT         (-110)
+#define HTTP_UE_SERVER_FAULTY_SHA256        (-111)
+#define HTTP_UE_DECOMPRESS_FAILED           (-112)
+#define HTTP_UE_NO_MIRROR                   (-113)
+#define HTTP_UE_BLOCK_VERIFY_FAILED         (-114)
+#define HTTP_UE_ABORTED                     (-115)
+#define HTTP_UE_NOT_STAGED                  (-116)
+#define HTTP_UE_BIN_FOR_WRONG_CHIP          (-117)
+#define HTTP_UE_BIN_FOR_WRONG_PROJECT       (-118)
+#define HTTP_UE_STREAM_ENDED                (-119)
+#define HTTP_UE_ACTIVATE_FAILED             (-120)
+#define HTTP_UE_NO_MEMORY                   (-121)
+
+/// image bytes checked before anything is written: image header, first segment header, app descriptor
+#define HTTP_UPDATE_PREFLIGHT_SIZE          (24 + 8 + 256)
+
+/// minimum time between two progress samples in ms
+#define HTTP_UPDATE_PROGRESS_INTERVAL       250
+
+/// without application activity for this many ms the idle bandwidth limit applies
+#define HTTP_UPDATE_IDLE_TIMEOUT            5000
+#define HTTP_UPDATE_BACKGROUND_STACK        8192
+
+/// delta patch stream format (all fields little endian)
+///   header: "ADLT", old size, new size, SHA-256 of old image, SHA-256 of new image
+///   then until new size is reached: control block { diff len, extra len, old seek }
+///   followed by diff len bytes added to the old image and extra len literal bytes
+#define HTTP_UPDATE_DELTA_MAGIC             "ADLT"
+
+/// bundle stream format (all fields little endian)
+///   header: "BNDL", version 1, segment count, 2 reserved bytes
+///   segment table: { type, 3 reserved bytes, size, SHA-256, 16 byte label } per segment
+///   then the segment contents in table order
+/// exactly one segment is the app, data segments go to the partition named
+/// "<label>_<n>" that belongs to the app slot ota_<n>, see partitionLabel()
+#define HTTP_UPDATE_BUNDLE_MAGIC            "BNDL"
+#define HTTP_UPDATE_BUNDLE_MAX_SEGMENTS     4
+#define HTTP_UPDATE_BUNDLE_APP              1
+#define HTTP_UPDATE_BUNDLE_DATA             2
 
 enum HTTPUpdateResult {
     HTTP_UPDATE_FAILED,
@@ -52,6 +101,59 @@ enum HTTPUpdateResult {
 
 typedef HTTPUpdateResult t_httpUpdate_return; // backward compatibility
 
+/// calls made by the last copy from the network into flash
+typedef struct {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t bytes;
+} HTTPUpdateCopyStats;
+
+/// progress of the running update, counted in image bytes written
+typedef struct {
+    uint32_t done;
+    uint32_t total;         ///< 0 if the size is not known up front
+    uint32_t rate;          ///< bytes per second over the last sample
+    uint32_t smoothedRate;  ///< bytes per second, moving average
+    uint32_t eta;           ///< seconds left, 0 if unknown
+    uint32_t stalled;       ///< ms since the last byte arrived
+} HTTPUpdateProgress;
+
+/// where the image goes, the dry runs download and hash it without touching flash
+enum HTTPUpdateSink {
+    HTTP_UPDATE_SINK_FLASH,
+    HTTP_UPDATE_SINK_NONE,
+    HTTP_UPDATE_SINK_RAM,
+    HTTP_UPDATE_SINK_MODEL      ///< sector writes go to the FlashModel given to setFlashModel
+};
+
+#define HTTP_UPDATE_RAM_SINK_SIZE           4096
+
+/// where the time of the last copy went, all in microseconds
+typedef struct {
+    uint32_t bytes;
+    uint32_t receive;       ///< stream reads, including TLS decryption
+    uint32_t decrypt;       ///< share of receive spent in TLS, if the transport reports it
+    uint32_t hash;          ///< dry runs only
+    uint32_t write;         ///< flash, RAM sink or flash model
+    uint32_t total;
+    uint8_t sha256[32];     ///< dry runs only
+} HTTPUpdateTimings;
+
+/// what the image header and app descriptor of the last image said
+typedef struct {
+    uint16_t chipId;
+    uint32_t flashSize;
+    char version[33];
+    char projectName[33];
+    char idfVersion[33];
+} HTTPUpdateImageInfo;
+
+/// return false to abort the update
+typedef std::function<bool(const HTTPUpdateProgress&)> HTTPUpdateProgressCallback;
+
+typedef std::function<HTTPUpdateResult(void)> HTTPUpdateJob;
+typedef std::function<void(HTTPUpdateResult)> HTTPUpdateDoneCallback;
+
 class HTTPUpdate
 {
 public:
@@ -64,6 +166,92 @@ public:
         _rebootOnUpdate = reboot;
     }
 
+    /// accept bsdiff style patches against the running image instead of full images
+    void setDeltaUpdate(bool delta)
+    {
+        _deltaUpdate = delta;
+    }
+
+    /// connections and range size used by updateFromMirrors
+    void setRangeDownload(uint8_t connections, size_t rangeSize = RANGE_STREAM_DEFAULT_RANGE)
+    {
+        _rangeConnections = connections;
+        _rangeSize = rangeSize;
+    }
+
+    /// PEM root certificate the https mirrors of updateFromMirrors must chain to
+    void setMirrorCACert(const char* rootCA)
+    {
+        _mirrorCA = rootCA;
+    }
+
+    /// observe the verified blocks of updateFromCar, e.g. to serve them to peers later
+    void onCarBlock(CarBlockCallback callback)
+    {
+        _carBlockCallback = callback;
+    }
+
+    /// keep booting the running image after an update until activateUpdate() is called
+    void setStageOnly(bool stageOnly)
+    {
+        _stageOnly = stageOnly;
+    }
+
+    /// entity tag kept for the next image when the server sends no ETag, e.g. its quoted CID
+    void setImageTag(const String& tag)
+    {
+        _imageTag = tag;
+    }
+
+    /// download and verify only, updates then report HTTP_UPDATE_OK without installing anything
+    void setSink(HTTPUpdateSink sink)
+    {
+        _sink = sink;
+    }
+
+    /// flash stand-in for HTTP_UPDATE_SINK_MODEL, e.g. to compare erase strategies
+    void setFlashModel(FlashModel* model)
+    {
+        _flashModel = model;
+    }
+
+    /// reject images whose app descriptor names another project, empty accepts any
+    void setProjectName(const String& projectName)
+    {
+        _projectName = projectName;
+    }
+
+    /// write one flash sector from a helper task while the next one is read
+    void setDoubleBuffer(bool doubleBuffer)
+    {
+        _doubleBuffer = doubleBuffer;
+    }
+
+    /// called at most every HTTP_UPDATE_PROGRESS_INTERVAL ms while the image is written
+    void onProgress(HTTPUpdateProgressCallback callback)
+    {
+        _progressCallback = callback;
+    }
+
+    /// cap the image bytes read per second while the application is active, 0 for no cap;
+    /// may be changed while an update runs
+    void setBandwidthLimit(uint32_t bytesPerSecond)
+    {
+        _bandwidthLimit = bytesPerSecond;
+    }
+
+    /// cap used while notifyActivity has not been called for HTTP_UPDATE_IDLE_TIMEOUT, 0 (the default) for no cap
+    void setIdleBandwidthLimit(uint32_t bytesPerSecond)
+    {
+        _idleBandwidthLimit = bytesPerSecond;
+    }
+
+    /// tell the updater the application is using the network
+    void notifyActivity(void)
+    {
+        _lastActivity = millis();
+    }
+
     void setLedPin(int ledPin = -1, uint8_t ledOn = HIGH)
     {
         _ledPin = ledPin;
@@ -80,23 +268,161 @@ public:
 
     t_httpUpdate_return updateSpiffs(WiFiClient& client, const String& url, const String& currentVersion = "");
 
+    /// fetch the same image as byte ranges from several mirrors in parallel; sha256 is the
+    /// digest of the file as served (e.g. from signed rollout metadata), nothing is committed without it
+    t_httpUpdate_return updateFromMirrors(const String urls[], size_t count, const uint8_t* sha256,
+                                          const String& currentVersion = "");
+
+    /// fetch the image with plain range GETs from a cacheable URL; "{cid}" in urlTemplate
+    /// is replaced by the CID, without it the CID is appended; only raw CIDs, whose multihash
+    /// is the digest of the file, can be verified this way
+    t_httpUpdate_return updateFromCid(const String& urlTemplate, const String& cid, const String& currentVersion = "");
+
+    /// fetch the image as a CAR from an IPFS gateway and verify every block against its CID
+    t_httpUpdate_return updateFromCar(WiFiClient& client, const String& gateway, const String& cid,
+                                      const String& currentVersion = "");
+
 
     int getLastError(void);
     String getLastErrorString(void);
 
+    HTTPUpdateCopyStats getCopyStats(void)
+    {
+        return _copyStats;
+    }
+
+    /// last progress sample, may be polled from another task
+    HTTPUpdateProgress getProgress(void);
+
+    /// stop the running update at its next read or progress sample, may be called from another task
+    void abort(void)
+    {
+        _abortRequested = true;
+    }
+
+    /// entity tag of the running image, empty if unknown
+    String getInstalledTag(void);
+
+    /// the image with this entity tag is running, or in flash to run after the next reset (boot or staged)
+    bool isInstalled(const String& tag);
+
+    HTTPUpdateTimings getTimings(void)
+    {
+        return _timings;
+    }
+
+    HTTPUpdateImageInfo getImageInfo(void)
+    {
+        return _imageInfo;
+    }
+
+    /// a verified image waits in the inactive partition, also after a reboot
+    bool hasStagedUpdate(void)
+    {
+        return stagedPartition() != NULL;
+    }
+
+    /// boot the staged image, verifying it once more
+    bool activateUpdate(bool reboot = true);
+
+    /// ms from the start of the last successful download until its image was in flash
+    uint32_t getStageTime(void)
+    {
+        return _stageTime;
+    }
+
+    /// data partition that belongs to the running app, "<base>_<n>" if the table has it, else base;
+    /// mount file systems with it, e.g. SPIFFS.begin(false, "/spiffs", 10, label.c_str())
+    static String partitionLabel(const char* base);
+
+    /// ms from activateUpdate() in the previous firmware until now, 0 if this boot was no activation.
+    /// call it once the application is up, later calls return 0
+    static uint32_t getActivationTime(void);
+
+    /// run an update call, e.g. a lambda calling update(), in its own task
+    bool runInBackground(HTTPUpdateJob job, HTTPUpdateDoneCallback done = nullptr,
+                         UBaseType_t priority = tskIDLE_PRIORITY);
+
+    bool backgroundRunning(void)
+    {
+        return _backgroundRunning;
+    }
+
 protected:
     t_httpUpdate_return handleUpdate(HTTPClient& http, const String& currentVersion, bool spiffs = false);
     //asvin change for POST request
     t_httpUpdate_return handleUpdate(HTTPClient& http, const String& currentVersion, String payload, String token, bool spiffs = false);
+    t_httpUpdate_return handleStream(Stream& stream, uint32_t len, const String& md5, bool spiffs, DecodeStream* decoded = NULL);
     bool runUpdate(Stream& in, uint32_t size, String md5, int command = U_FLASH);
+    bool runUpdate(DecodeStream& in, String md5, int command = U_FLASH, DecodeStream* body = NULL);
+    bool runDeltaUpdate(Stream& in, uint32_t size, String md5, DecodeStream* decoded = NULL, DecodeStream* body = NULL);
+    bool runBundleUpdate(Stream& in, DecodeStream* body = NULL);
+    bool runDryRun(Stream& in, uint32_t size, const String& md5, DecodeStream* decoded = NULL, DecodeStream* body = NULL);
+    bool bodyFinished(DecodeStream* body);
+    bool writePartition(SegmentStream& in, const esp_partition_t* partition, uint32_t size);
+    uint32_t copyStream(Stream& in, uint32_t size, bool preflight = false);
+    bool checkImage(const uint8_t* data, size_t len);
+    void stageDone(void);
+    const esp_partition_t* stagedPartition(void);
+    void storeStagedPartition(const esp_partition_t* partition);
+    String partitionTag(const esp_partition_t* partition);
+    void storePartitionTag(const esp_partition_t* partition, const String& tag);
+    void progressBegin(uint32_t total);
+    bool progressUpdate(uint32_t done, bool force = false);
+    bool progressTick(void);
+    void progressEnd(void);
+    size_t bandwidthAllow(size_t want);
+    void bandwidthUse(size_t used);
 
     int _lastError;
     bool _rebootOnUpdate = false;
+    bool _deltaUpdate = false;
+    bool _doubleBuffer = false;
+    bool _stageOnly = false;
+    String _projectName;
+    HTTPUpdateSink _sink = HTTP_UPDATE_SINK_FLASH;
+    FlashModel* _flashModel = NULL;
+    HTTPUpdateTimings _timings;
+    String _imageTag;
+    String _responseTag;
+    HTTPUpdateImageInfo _imageInfo;
+    int _copyError = 0;
+    const esp_partition_t* _stagedPartition = NULL;
+    bool _stagedLoaded = false;
+    unsigned long _stageStart = 0;
+    uint32_t _stageTime = 0;
+    HTTPUpdateCopyStats _copyStats = { 0, 0, 0 };
 private:
     int _httpClientTimeout;
 
     int _ledPin;
     uint8_t _ledOn;
+
+    uint8_t _rangeConnections = RANGE_STREAM_DEFAULT_CONNECTIONS;
+    size_t _rangeSize = RANGE_STREAM_DEFAULT_RANGE;
+    const char* _mirrorCA = NULL;
+
+    CarBlockCallback _carBlockCallback;
+
+    HTTPUpdateProgressCallback _progressCallback;
+    HTTPUpdateProgress _progress = { 0, 0, 0, 0, 0, 0 };
+    bool _progressActive = false;
+    bool _progressAborted = false;
+    volatile bool _abortRequested = false;
+    portMUX_TYPE _progressMux = portMUX_INITIALIZER_UNLOCKED;
+    unsigned long _progressStart = 0;
+    unsigned long _progressSample = 0;
+    unsigned long _progressLastByte = 0;
+    uint32_t _progressSampleBytes = 0;
+
+    volatile uint32_t _bandwidthLimit = 0;
+    volatile uint32_t _idleBandwidthLimit = 0;
+    volatile unsigned long _lastActivity = 0;
+    uint32_t _bucketTokens = 0;
+    unsigned long _bucketTime = 0;
+
+    volatile bool _backgroundRunning = false;
+    static void backgroundTask(void* arg);
 };
 
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_HTTPUPDATE)
@@ -0,0 +1,23 @@
+/**
+ * ImageState.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "ImageState.h"
+#include <string.h>
+
+ImageState imageState(const char* tag, const char* runningTag, const char* bootTag, const char* stagedTag)
+{
+    if(!tag || !tag[0]) {
+        return IMAGE_UNKNOWN;
+    }
+    if(runningTag && strcmp(tag, runningTag) == 0) {
+        return IMAGE_RUNNING;
+    }
+    // without stage only, Update.end() makes the new image the boot partition until the next reset
+    if((bootTag && strcmp(tag, bootTag) == 0) || (stagedTag && strcmp(tag, stagedTag) == 0)) {
+        return IMAGE_PENDING;
+    }
+    return IMAGE_UNKNOWN;
+}
@@ -0,0 +1,24 @@
+/**
+ * ImageState.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___IMAGE_STATE_H___
+#define ___IMAGE_STATE_H___
+
+/// where the image with an entity tag is among the app partitions
+enum ImageState {
+    IMAGE_UNKNOWN,      ///< in none of them, or the tag is empty
+    IMAGE_RUNNING,
+    IMAGE_PENDING       ///< in flash and not running yet: set to boot or staged
+};
+
+/**
+ * decide the state from the tags stored for the running, boot and staged
+ * partitions (empty where there is none or it is the running one)
+ *
+ * free of the framework so the native tests build it
+ */
+ImageState imageState(const char* tag, const char* runningTag, const char* bootTag, const char* stagedTag);
+
+#endif /* ___IMAGE_STATE_H___ */
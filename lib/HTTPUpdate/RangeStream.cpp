@@ -0,0 +1,441 @@
+/**
+ * RangeStream.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "RangeStream.h"
+
+RangeStream::RangeStream(size_t rangeSize, uint8_t connections, uint32_t timeout)
+        : _sourceCount(0), _connections(connections), _retryCount(0), _rangeSize(rangeSize), _timeout(timeout),
+          _rootCA(NULL), _total(0), _rangeCount(0), _nextRange(0), _writeRange(0), _published(-1)
+{
+    if(_connections == 0) {
+        _connections = 1;
+    } else if(_connections > RANGE_STREAM_MAX_CONNECTIONS) {
+        _connections = RANGE_STREAM_MAX_CONNECTIONS;
+    }
+    for(uint8_t i = 0; i < RANGE_STREAM_MAX_CONNECTIONS; i++) {
+        _conns[i].source = -1;
+        _conns[i].range = -1;
+        _conns[i].buf = NULL;
+        _conns[i].got = 0;
+        _conns[i].want = 0;
+        _conns[i].keepAlive = false;
+    }
+}
+
+RangeStream::~RangeStream(void)
+{
+    for(uint8_t i = 0; i < RANGE_STREAM_MAX_CONNECTIONS; i++) {
+        if(_conns[i].client) {
+            _conns[i].client->stop();
+        }
+        free(_conns[i].buf);
+    }
+}
+
+bool RangeStream::addSource(const String& url)
+{
+    if(_sourceCount >= RANGE_STREAM_MAX_SOURCES) {
+        return false;
+    }
+
+    int index = url.indexOf("://");
+    if(index < 0) {
+        log_e("mirror url without scheme: %s\n", url.c_str());
+        return false;
+    }
+
+    Source& s = _sources[_sourceCount];
+    s.secure = url.substring(0, index).equalsIgnoreCase("https");
+    String rest = url.substring(index + 3);
+    index = rest.indexOf('/');
+    s.host = (index < 0) ? rest : rest.substring(0, index);
+    s.path = (index < 0) ? String("/") : rest.substring(index);
+    s.port = s.secure ? 443 : 80;
+    index = s.host.indexOf(':');
+    if(index >= 0) {
+        s.port = s.host.substring(index + 1).toInt();
+        s.host.remove(index);
+    }
+    s.dropped = false;
+    s.users = 0;
+    s.bytes = 0;
+    s.ms = 0;
+    _sourceCount++;
+    return true;
+}
+
+bool RangeStream::begin(void)
+{
+    for(uint8_t i = 0; i < _connections; i++) {
+        _conns[i].buf = (uint8_t *) malloc(_rangeSize);
+        if(!_conns[i].buf) {
+            log_e("no memory for range buffer %u\n", i);
+            _failed = true;
+            return false;
+        }
+    }
+
+    // the first answer tells the total size, its body already is range 0
+    while(activeSources() > 0) {
+        if(startRange(_conns[0], 0)) {
+            _nextRange = 1;
+            return true;
+        }
+        _retryCount = 0;
+    }
+    _failed = true;
+    return false;
+}
+
+void RangeStream::decode(void)
+{
+    // the consumer is done with the last published range
+    if(_published >= 0) {
+        release(_conns[_published], false);
+        _published = -1;
+    }
+
+    if(_writeRange >= _rangeCount) {
+        _finished = true;
+        return;
+    }
+
+    while(true) {
+        for(uint8_t i = 0; i < _connections; i++) {
+            if(_conns[i].range < 0) {
+                int32_t range = takeRange();
+                if(range >= 0) {
+                    startRange(_conns[i], range);
+                }
+            }
+        }
+
+        bool progress = false;
+        for(uint8_t i = 0; i < _connections; i++) {
+            if(_conns[i].range >= 0 && _conns[i].got < _conns[i].want) {
+                progress |= poll(_conns[i]);
+            }
+        }
+
+        for(uint8_t i = 0; i < _connections; i++) {
+            Connection& c = _conns[i];
+            if(c.range == _writeRange && c.got == c.want) {
+                _data = c.buf;
+                _len = c.want;
+                _published = i;
+                _writeRange++;
+                return;
+            }
+        }
+
+        if(activeSources() == 0) {
+            log_e("no mirror left for range %d\n", _writeRange);
+            _failed = true;
+            return;
+        }
+
+        rebalance();
+
+        if(!progress) {
+            if(_tick && !_tick()) {
+                _failed = true;
+                return;
+            }
+            delay(1);
+        }
+    }
+}
+
+bool RangeStream::startRange(Connection& c, int32_t range)
+{
+    if(c.source < 0 || _sources[c.source].dropped) {
+        if(c.client) {
+            c.client->stop();
+        }
+        c.client.reset();
+        if(c.source >= 0) {
+            _sources[c.source].users--;
+        }
+        c.source = pickSource();
+        if(c.source < 0) {
+            c.range = range;
+            release(c, true);
+            return false;
+        }
+        _sources[c.source].users++;
+    }
+
+    Source& s = _sources[c.source];
+    if(!c.client || !c.keepAlive || !c.client->connected()) {
+        if(c.client) {
+            c.client->stop();
+        }
+        if(s.secure) {
+            WiFiClientSecure* tls = new WiFiClientSecure;
+            if(_rootCA) {
+                tls->setCACert(_rootCA);
+            }
+            c.client.reset(tls);
+        } else {
+            c.client.reset(new WiFiClient);
+        }
+        if(!c.client->connect(s.host.c_str(), s.port)) {
+            c.range = range;
+            dropSource(c, "connect failed");
+            return false;
+        }
+    }
+
+    uint32_t start = range * _rangeSize;
+    String request = "GET " + s.path + " HTTP/1.1\r\n";
+    request += "Host: " + s.host + "\r\n";
+    request += "User-Agent: ESP32-http-Update\r\n";
+    request += "Connection: keep-alive\r\n";
+    request += "Range: bytes=" + String(start) + "-";
+    if(_total > 0) {
+        uint32_t end = start + _rangeSize;
+        if(end > _total) {
+            end = _total;
+        }
+        request += String(end - 1);
+    } else {
+        request += String(start + _rangeSize - 1);
+    }
+    request += "\r\n\r\n";
+
+    c.range = range;
+    c.got = 0;
+    c.started = millis();
+    c.lastData = c.started;
+    c.client->print(request);
+
+    if(!readResponse(c, start)) {
+        dropSource(c, "bad range response");
+        return false;
+    }
+    return true;
+}
+
+bool RangeStream::readResponse(Connection& c, uint32_t start)
+{
+    WiFiClient& client = *c.client;
+    while(!client.available()) {
+        if(!client.connected() || millis() - c.started > _timeout) {
+            return false;
+        }
+        delay(1);
+    }
+
+    String line = client.readStringUntil('\n');
+    if(line.length() < 12 || line.substring(9, 12).toInt() != 206) {
+        log_e("range request answered with: %s\n", line.c_str());
+        return false;
+    }
+
+    int32_t length = -1;
+    uint32_t total = 0;
+    uint32_t first = UINT32_MAX;
+    c.keepAlive = true;
+    while(true) {
+        line = client.readStringUntil('\n');
+        line.trim();
+        if(line.length() == 0) {
+            break;
+        }
+        int colon = line.indexOf(':');
+        if(colon < 0) {
+            continue;
+        }
+        String name = line.substring(0, colon);
+        String value = line.substring(colon + 1);
+        value.trim();
+        if(name.equalsIgnoreCase("Content-Length")) {
+            length = value.toInt();
+        } else if(name.equalsIgnoreCase("Content-Range")) {
+            // bytes <first>-<last>/<total>
+            first = value.substring(6, value.indexOf('-')).toInt();
+            total = value.substring(value.indexOf('/') + 1).toInt();
+        } else if(name.equalsIgnoreCase("Connection")) {
+            c.keepAlive = !value.equalsIgnoreCase("close");
+        } else if(name.equalsIgnoreCase("Transfer-Encoding")) {
+            return false;
+        }
+    }
+
+    if(first != start || length <= 0 || total == 0) {
+        return false;
+    }
+    if(_total == 0) {
+        _total = total;
+        _rangeCount = (_total + _rangeSize - 1) / _rangeSize;
+    } else if(total != _total) {
+        log_e("mirror serves a different image (%u != %u bytes)\n", total, _total);
+        return false;
+    }
+
+    size_t want = _total - start;
+    if(want > _rangeSize) {
+        want = _rangeSize;
+    }
+    if((size_t) length != want) {
+        return false;
+    }
+    c.want = want;
+    return true;
+}
+
+bool RangeStream::poll(Connection& c)
+{
+    int available = c.client->available();
+    if(available <= 0) {
+        if(!c.client->connected()) {
+            dropSource(c, "connection lost");
+        } else if(millis() - c.lastData > RANGE_STREAM_STALL_TIMEOUT) {
+            dropSource(c, "stalled");
+        }
+        return false;
+    }
+
+    size_t n = c.want - c.got;
+    if(n > (size_t) available) {
+        n = available;
+    }
+    int read = c.client->read(c.buf + c.got, n);
+    if(read <= 0) {
+        return false;
+    }
+    c.got += read;
+    c.lastData = millis();
+
+    if(c.got == c.want) {
+        Source& s = _sources[c.source];
+        s.bytes += c.want;
+        s.ms += c.lastData - c.started + 1;
+        if(!c.keepAlive) {
+            c.client->stop();
+        }
+    }
+    return true;
+}
+
+void RangeStream::release(Connection& c, bool requeue)
+{
+    if(requeue && c.range >= 0 && _retryCount < sizeof(_retry) / sizeof(_retry[0])) {
+        _retry[_retryCount++] = c.range;
+    }
+    // a half read body leaves the connection unusable
+    if(c.got < c.want && c.client) {
+        c.client->stop();
+    }
+    c.range = -1;
+    c.got = 0;
+    c.want = 0;
+}
+
+void RangeStream::dropSource(Connection& c, const char* reason)
+{
+    Source& s = _sources[c.source];
+    log_w("dropping mirror %s (%s) at range %d\n", s.host.c_str(), reason, c.range);
+    s.dropped = true;
+    if(c.client) {
+        c.client->stop();
+    }
+    release(c, true);
+}
+
+void RangeStream::rebalance(void)
+{
+    int head = -1;
+    int idle = -1;
+    int furthest = -1;
+    bool waiting = false;
+    for(uint8_t i = 0; i < _connections; i++) {
+        Connection& c = _conns[i];
+        if(c.range < 0) {
+            idle = i;
+        } else if(c.range == _writeRange) {
+            head = i;
+        } else {
+            if(c.got == c.want) {
+                waiting = true;
+            }
+            if(furthest < 0 || c.range > _conns[furthest].range) {
+                furthest = i;
+            }
+        }
+    }
+
+    // the next range to write went back to the queue but every connection is busy further ahead
+    if(head < 0 && idle < 0 && furthest >= 0) {
+        release(_conns[furthest], true);
+        return;
+    }
+
+    // only worth dropping the head source when others already wait for it
+    if(head < 0 || !waiting || activeSources() < 2) {
+        return;
+    }
+    Connection& c = _conns[head];
+    uint32_t elapsed = millis() - c.started;
+    if(elapsed < RANGE_STREAM_SLOW_SAMPLE_MS) {
+        return;
+    }
+    uint32_t rate = (uint64_t) c.got * 1000 / elapsed;
+    uint32_t best = 0;
+    for(size_t i = 0; i < _sourceCount; i++) {
+        const Source& s = _sources[i];
+        if((int) i != c.source && !s.dropped && s.ms > 0) {
+            uint32_t sourceRate = (uint64_t) s.bytes * 1000 / s.ms;
+            if(sourceRate > best) {
+                best = sourceRate;
+            }
+        }
+    }
+    if(rate * RANGE_STREAM_SLOW_FACTOR < best) {
+        dropSource(c, "too slow");
+    }
+}
+
+int RangeStream::pickSource(void)
+{
+    int best = -1;
+    for(size_t i = 0; i < _sourceCount; i++) {
+        if(!_sources[i].dropped && (best < 0 || _sources[i].users < _sources[best].users)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int32_t RangeStream::takeRange(void)
+{
+    if(_retryCount > 0) {
+        size_t lowest = 0;
+        for(size_t i = 1; i < _retryCount; i++) {
+            if(_retry[i] < _retry[lowest]) {
+                lowest = i;
+            }
+        }
+        int32_t range = _retry[lowest];
+        _retry[lowest] = _retry[--_retryCount];
+        return range;
+    }
+    if(_nextRange < _rangeCount) {
+        return _nextRange++;
+    }
+    return -1;
+}
+
+size_t RangeStream::activeSources(void) const
+{
+    size_t count = 0;
+    for(size_t i = 0; i < _sourceCount; i++) {
+        if(!_sources[i].dropped) {
+            count++;
+        }
+    }
+    return count;
+}
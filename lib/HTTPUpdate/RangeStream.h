@@ -0,0 +1,125 @@
+/**
+ * RangeStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___RANGE_STREAM_H___
+#define ___RANGE_STREAM_H___
+
+#include <memory>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+#include "DecodeStream.h"
+
+#define RANGE_STREAM_MAX_SOURCES            (4)
+#define RANGE_STREAM_MAX_CONNECTIONS        (3)
+#define RANGE_STREAM_DEFAULT_CONNECTIONS    (2)
+#define RANGE_STREAM_DEFAULT_RANGE          (16 * 1024)
+
+/// a source is dropped when it sends nothing for this long
+#define RANGE_STREAM_STALL_TIMEOUT          (5000)
+/// ... or when it holds up the write position while being this much slower than the best source
+#define RANGE_STREAM_SLOW_FACTOR            (4)
+#define RANGE_STREAM_SLOW_SAMPLE_MS         (2000)
+
+/**
+ * fetches one image as HTTP byte ranges from several mirrors at once and
+ * hands the ranges out in order
+ *
+ * every connection owns one range buffer, so RAM use is connections * range
+ * size. Ranges of a failed or slow source go back to the queue and are
+ * fetched from the remaining sources.
+ */
+class RangeStream : public DecodeStream
+{
+public:
+    RangeStream(size_t rangeSize = RANGE_STREAM_DEFAULT_RANGE, uint8_t connections = RANGE_STREAM_DEFAULT_CONNECTIONS,
+                uint32_t timeout = 8000);
+    ~RangeStream(void);
+
+    /// http:// or https:// url that serves the image and honours Range requests
+    bool addSource(const String& url);
+
+    /// PEM root certificate the https sources must chain to, unset they are not authenticated
+    void setCACert(const char* rootCA)
+    {
+        _rootCA = rootCA;
+    }
+
+    /// probe the image size from the first source that answers
+    bool begin(void);
+
+    uint32_t size(void) const
+    {
+        return _total;
+    }
+
+    /// called while no connection has new data, returning false fails the stream
+    void onTick(StreamTickCallback tick)
+    {
+        _tick = tick;
+    }
+
+    /// every source was dropped, nothing is left to fetch the missing ranges from
+    bool exhausted(void) const
+    {
+        return activeSources() == 0;
+    }
+
+protected:
+    void decode(void);
+
+private:
+    struct Source {
+        String host;
+        String path;
+        uint16_t port;
+        bool secure;
+        bool dropped;
+        uint8_t users;
+        uint32_t bytes;
+        uint32_t ms;
+    };
+
+    struct Connection {
+        int source;
+        std::unique_ptr<WiFiClient> client;
+        int32_t range;
+        uint8_t* buf;
+        size_t got;
+        size_t want;
+        bool keepAlive;
+        uint32_t started;
+        uint32_t lastData;
+    };
+
+    bool startRange(Connection& c, int32_t range);
+    bool readResponse(Connection& c, uint32_t start);
+    bool poll(Connection& c);
+    void release(Connection& c, bool requeue);
+    void dropSource(Connection& c, const char* reason);
+    void rebalance(void);
+    int pickSource(void);
+    int32_t takeRange(void);
+    size_t activeSources(void) const;
+
+    Source _sources[RANGE_STREAM_MAX_SOURCES];
+    size_t _sourceCount;
+    Connection _conns[RANGE_STREAM_MAX_CONNECTIONS];
+    uint8_t _connections;
+
+    int32_t _retry[RANGE_STREAM_MAX_CONNECTIONS * 2];
+    size_t _retryCount;
+
+    size_t _rangeSize;
+    uint32_t _timeout;
+    const char* _rootCA;
+    uint32_t _total;
+    int32_t _rangeCount;
+    int32_t _nextRange;
+    int32_t _writeRange;
+    int _published;
+    StreamTickCallback _tick;
+};
+
+#endif /* ___RANGE_STREAM_H___ */
@@ -0,0 +1,169 @@
+/**
+ * SectorWriter.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "SectorWriter.h"
+#include <Update.h>
+
+SectorWriter::SectorWriter(void)
+        : _model(NULL), _current(0), _fill(0), _doubleBuffer(false), _full(NULL), _free(NULL), _done(NULL), _failed(false), _writes(0)
+{
+    _buf[0] = NULL;
+    _buf[1] = NULL;
+}
+
+SectorWriter::~SectorWriter(void)
+{
+    if(_full || _buf[0]) {
+        end();
+    }
+}
+
+bool SectorWriter::begin(bool doubleBuffer, FlashModel* model)
+{
+    _model = model;
+    _doubleBuffer = doubleBuffer;
+    _current = 0;
+    _fill = 0;
+    _failed = false;
+    _writes = 0;
+
+    _buf[0] = (uint8_t *) malloc(SECTOR_WRITER_SIZE);
+    if(_doubleBuffer) {
+        _buf[1] = (uint8_t *) malloc(SECTOR_WRITER_SIZE);
+        _full = xQueueCreate(2, sizeof(Sector));
+        _free = xQueueCreate(2, sizeof(uint8_t));
+        _done = xSemaphoreCreateBinary();
+        if(!_buf[1] || !_full || !_free || !_done
+                || xTaskCreate(writerTask, "sectorWriter", SECTOR_WRITER_TASK_STACK, this, uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+            log_w("double buffering not available, writing inline\n");
+            free(_buf[1]);
+            _buf[1] = NULL;
+            if(_full) vQueueDelete(_full);
+            if(_free) vQueueDelete(_free);
+            if(_done) vSemaphoreDelete(_done);
+            _full = NULL;
+            _free = NULL;
+            _done = NULL;
+            _doubleBuffer = false;
+        } else {
+            uint8_t index = 1;
+            xQueueSend(_free, &index, 0);
+        }
+    }
+
+    if(!_buf[0]) {
+        log_e("no memory for sector buffer\n");
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+uint8_t* SectorWriter::space(size_t& len)
+{
+    len = SECTOR_WRITER_SIZE - _fill;
+    return _buf[_current] + _fill;
+}
+
+bool SectorWriter::commit(size_t len)
+{
+    _fill += len;
+    if(_fill < SECTOR_WRITER_SIZE) {
+        return !_failed;
+    }
+    return submit();
+}
+
+bool SectorWriter::write(const uint8_t* data, size_t len)
+{
+    while(len > 0) {
+        size_t room;
+        uint8_t* dst = space(room);
+        size_t n = (len > room) ? room : len;
+        memcpy(dst, data, n);
+        if(!commit(n)) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool SectorWriter::end(void)
+{
+    if(_fill > 0 && !_failed) {
+        submit();
+    }
+
+    if(_doubleBuffer && _full) {
+        Sector stop = { 0, 0 };
+        xQueueSend(_full, &stop, portMAX_DELAY);
+        xSemaphoreTake(_done, portMAX_DELAY);
+        vQueueDelete(_full);
+        vQueueDelete(_free);
+        vSemaphoreDelete(_done);
+        _full = NULL;
+        _free = NULL;
+        _done = NULL;
+    }
+
+    free(_buf[0]);
+    free(_buf[1]);
+    _buf[0] = NULL;
+    _buf[1] = NULL;
+    return !_failed;
+}
+
+void SectorWriter::abort(void)
+{
+    _fill = 0;
+    end();
+}
+
+bool SectorWriter::submit(void)
+{
+    if(_failed) {
+        return false;
+    }
+
+    if(!_doubleBuffer) {
+        bool ok = flashWrite(_buf[0], _fill);
+        _fill = 0;
+        return ok;
+    }
+
+    Sector sector = { _current, _fill };
+    xQueueSend(_full, &sector, portMAX_DELAY);
+    xQueueReceive(_free, &_current, portMAX_DELAY);
+    _fill = 0;
+    return !_failed;
+}
+
+bool SectorWriter::flashWrite(uint8_t* data, size_t len)
+{
+    _writes++;
+    size_t written = _model ? _model->write(data, len) : Update.write(data, len);
+    if(written != len) {
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+void SectorWriter::writerTask(void* arg)
+{
+    SectorWriter* writer = (SectorWriter *) arg;
+    Sector sector;
+    while(xQueueReceive(writer->_full, &sector, portMAX_DELAY) == pdTRUE && sector.len > 0) {
+        if(!writer->_failed) {
+            writer->flashWrite(writer->_buf[sector.index], sector.len);
+        }
+        xQueueSend(writer->_free, &sector.index, portMAX_DELAY);
+    }
+    xSemaphoreGive(writer->_done);
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,80 @@
+/**
+ * SectorWriter.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___SECTOR_WRITER_H___
+#define ___SECTOR_WRITER_H___
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include "FlashModel.h"
+
+#define SECTOR_WRITER_SIZE          (4096)
+#define SECTOR_WRITER_TASK_STACK    (6144)
+
+/**
+ * coalesces Update writes into whole flash sectors
+ *
+ * the caller either reads straight into space()/commit() or copies with
+ * write(); every sector is handed to Update.write in one call, so each call
+ * maps to one erase and one program. With double buffering a helper task
+ * writes the full sector while the caller fills the other one.
+ */
+class SectorWriter
+{
+public:
+    SectorWriter(void);
+    ~SectorWriter(void);
+
+    /// model set: sectors go to the flash model instead of Update
+    bool begin(bool doubleBuffer = false, FlashModel* model = NULL);
+
+    /// free room in the current sector buffer
+    uint8_t* space(size_t& len);
+    /// account for len bytes placed at space(), writes the sector once full
+    bool commit(size_t len);
+    bool write(const uint8_t* data, size_t len);
+
+    /// write the last partial sector and wait for the helper task
+    bool end(void);
+    /// drop the partial sector and wait for the helper task
+    void abort(void);
+
+    bool failed(void) const
+    {
+        return _failed;
+    }
+
+    uint32_t writes(void) const
+    {
+        return _writes;
+    }
+
+private:
+    bool submit(void);
+    bool flashWrite(uint8_t* data, size_t len);
+    static void writerTask(void* arg);
+
+    struct Sector {
+        uint8_t index;
+        size_t len;
+    };
+
+    FlashModel* _model;
+    uint8_t* _buf[2];
+    uint8_t _current;
+    size_t _fill;
+    bool _doubleBuffer;
+
+    QueueHandle_t _full;
+    QueueHandle_t _free;
+    SemaphoreHandle_t _done;
+
+    volatile bool _failed;
+    volatile uint32_t _writes;
+};
+
+#endif /* ___SECTOR_WRITER_H___ */
@@ -0,0 +1,44 @@
+/**
+ * SegmentStream.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "SegmentStream.h"
+
+SegmentStream::SegmentStream(Stream& src, uint32_t size)
+        : _src(src), _remaining(size)
+{
+    memset(_sha256, 0, sizeof(_sha256));
+    mbedtls_sha256_init(&_ctx);
+    mbedtls_sha256_starts_ret(&_ctx, 0);
+    if(_remaining == 0) {
+        mbedtls_sha256_finish_ret(&_ctx, _sha256);
+        _finished = true;
+    }
+}
+
+SegmentStream::~SegmentStream(void)
+{
+    mbedtls_sha256_free(&_ctx);
+}
+
+void SegmentStream::decode(void)
+{
+    size_t want = (_remaining > sizeof(_buf)) ? sizeof(_buf) : _remaining;
+    size_t got = _src.readBytes((char *) _buf, want);
+    if(got == 0) {
+        log_e("segment ended %u bytes early\n", _remaining);
+        _failed = true;
+        return;
+    }
+
+    mbedtls_sha256_update_ret(&_ctx, _buf, got);
+    _data = _buf;
+    _len = got;
+    _remaining -= got;
+    if(_remaining == 0) {
+        mbedtls_sha256_finish_ret(&_ctx, _sha256);
+        _finished = true;
+    }
+}
@@ -0,0 +1,39 @@
+/**
+ * SegmentStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___SEGMENT_STREAM_H___
+#define ___SEGMENT_STREAM_H___
+
+#include "DecodeStream.h"
+#include <mbedtls/sha256.h>
+
+/**
+ * one segment of a bundle: the next size bytes of the source, hashed on the way
+ *
+ * finished() reports true once all size bytes were read, sha256() is valid from then on.
+ */
+class SegmentStream : public DecodeStream
+{
+public:
+    SegmentStream(Stream& src, uint32_t size);
+    ~SegmentStream(void);
+
+    const uint8_t * sha256(void) const
+    {
+        return _sha256;
+    }
+
+protected:
+    void decode(void);
+
+private:
+    Stream& _src;
+    uint32_t _remaining;
+    mbedtls_sha256_context _ctx;
+    uint8_t _sha256[32];
+    uint8_t _buf[512];
+};
+
+#endif /* ___SEGMENT_STREAM_H___ */
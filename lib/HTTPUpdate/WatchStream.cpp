@@ -0,0 +1,65 @@
+/**
+ * WatchStream.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+
+#include "WatchStream.h"
+
+WatchStream::WatchStream(Client& src, uint32_t timeout, StreamTickCallback tick)
+        : _src(src), _tick(tick)
+{
+    setTimeout(timeout);
+}
+
+int WatchStream::available()
+{
+    return _src.available();
+}
+
+int WatchStream::read()
+{
+    return wait() ? _src.read() : -1;
+}
+
+int WatchStream::peek()
+{
+    return wait() ? _src.peek() : -1;
+}
+
+size_t WatchStream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length && wait()) {
+        // only what is there already, so the client never blocks on its own
+        size_t n = _src.available();
+        if(n > length - count) {
+            n = length - count;
+        }
+        int got = _src.read((uint8_t *) buffer + count, n);
+        if(got <= 0) {
+            break;
+        }
+        count += got;
+    }
+    return count;
+}
+
+/**
+ * wait for the next byte, ticking while there is none
+ * @return true if a byte can be read
+ */
+bool WatchStream::wait(void)
+{
+    unsigned long start = millis();
+    while(_src.available() <= 0) {
+        if(_tick && !_tick()) {
+            return false;
+        }
+        if(!_src.connected() || millis() - start >= _timeout) {
+            return false;
+        }
+        delay(WATCH_STREAM_POLL);
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+/**
+ * WatchStream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___WATCH_STREAM_H___
+#define ___WATCH_STREAM_H___
+
+#include <Client.h>
+#include "DecodeStream.h"
+
+/// poll interval while a read waits for data, in ms
+#define WATCH_STREAM_POLL           (10)
+
+/**
+ * passes a network client through, but waits for data itself
+ *
+ * a blocked readBytes() of the client is silent until its timeout, here
+ * the tick callback runs every WATCH_STREAM_POLL ms while nothing arrives,
+ * so progress (and a stall) is reported and an abort is seen at once.
+ * A read returns short when the tick asks to stop, the peer closed or
+ * nothing came for timeout ms.
+ */
+class WatchStream : public Stream
+{
+public:
+    WatchStream(Client& src, uint32_t timeout, StreamTickCallback tick);
+
+    int available();
+    int read();
+    int peek();
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length)
+    {
+        return readBytes((char *) buffer, length);
+    }
+
+    size_t write(uint8_t)
+    {
+        return 0;
+    }
+
+    void flush()
+    {
+    }
+
+private:
+    bool wait(void);
+
+    Client& _src;
+    StreamTickCallback _tick;
+};
+
+#endif /* ___WATCH_STREAM_H___ */
@@ -316,6 +316,13 @@ boolean WiFiManager::autoConnect(char const *apName, char const *apPassword) {
       // and we have no idea WHAT we are connected to
     }
 
+    // directed connect to the last good ap, skips the channel scan and dhcp
+    #ifdef ESP32
+    if(!connected && _fastConnect && _defaultssid == ""){
+      connected = fastConnect();
+    }
+    #endif
+
     if(connected || connectWifi(_defaultssid, _defaultpass) == WL_CONNECTED){
       //connected
       #ifdef WM_DEBUG_LEVEL
@@ -324,6 +331,10 @@ boolean WiFiManager::autoConnect(char const *apName, char const *apPassword) {
       #endif
       _lastconxresult = WL_CONNECTED;
 
+      #ifdef ESP32
+      if(_fastConnect) storeFastConnect();
+      #endif
+
       if((String)_hostname != ""){
         #ifdef WM_DEBUG_LEVEL
           DEBUG_WM(DEBUG_DEV,F("hostname: STA: "),getWiFiHostname());
@@ -1069,6 +1080,109 @@ bool WiFiManager::setSTAConfig(){
   return ret;
 }
 
+#ifdef ESP32
+/**
+ * connect to the saved ap using the bssid, channel and ip lease of the last good connection
+ * skips the all channel scan and dhcp, the caller falls back to connectWifi on failure
+ * @since $dev
+ * @return bool connected
+ */
+bool WiFiManager::fastConnect(){
+  wm_fastconn_t conn;
+  Preferences prefs;
+  prefs.begin("wmfast", true);
+  size_t len = prefs.getBytes("conn", &conn, sizeof(conn));
+  prefs.end();
+
+  String ssid = WiFi_SSID(true);
+  if(len != sizeof(conn) || conn.channel == 0 || ssid == "" || ssid != conn.ssid){
+    #ifdef WM_DEBUG_LEVEL
+    DEBUG_WM(DEBUG_VERBOSE,F("fastConnect: no cached connection for saved ap"));
+    #endif
+    return false;
+  }
+
+  // a user static config always wins over the cached lease
+  bool reuseIP = _fastConnectIP && !_sta_static_ip && conn.ip != 0;
+  _fastConnectReused = false;
+  if(reuseIP){
+    WiFi.config(IPAddress(conn.ip), IPAddress(conn.gw), IPAddress(conn.sn), IPAddress(conn.dns));
+  }
+  else setSTAConfig();
+
+  #ifdef WM_DEBUG_LEVEL
+  DEBUG_WM(F("fastConnect: channel"),(String)conn.channel);
+  if(reuseIP) DEBUG_WM(DEBUG_VERBOSE,F("fastConnect: reusing"),IPAddress(conn.ip));
+  #endif
+
+  // the bssid lock must not end up in the saved config
+  unsigned long start = millis();
+  WiFi.persistent(false);
+  WiFi.begin(ssid.c_str(), WiFi_psk(true).c_str(), conn.channel, conn.bssid, true);
+  uint8_t res = waitForConnectResult(_fastConnectTimeout);
+  if(res == WL_CONNECTED){
+    if(_userpersistent) WiFi.persistent(true);
+    _fastConnectReused = reuseIP;
+    #ifdef WM_DEBUG_LEVEL
+    DEBUG_WM(F("fastConnect: connected in"),(String)(millis() - start)+" ms");
+    #endif
+    return true;
+  }
+
+  // ap moved or lease is gone, drop the cache and undo the directed config
+  #ifdef WM_DEBUG_LEVEL
+  DEBUG_WM(F("fastConnect: failed,"),getWLStatusString(res));
+  #endif
+  WiFi_Disconnect();
+  if(reuseIP) WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  WiFi.begin(ssid.c_str(), WiFi_psk(true).c_str(), 0, NULL, false);
+  if(_userpersistent) WiFi.persistent(true);
+  clearFastConnect();
+  return false;
+}
+
+/**
+ * remember the current connection for fastConnect, only writes nvs when it changed
+ * @since $dev
+ */
+void WiFiManager::storeFastConnect(){
+  wifi_ap_record_t info;
+  if(esp_wifi_sta_get_ap_info(&info) != ESP_OK) return;
+
+  wm_fastconn_t conn;
+  memset(&conn, 0, sizeof(conn));
+  strncpy(conn.ssid, reinterpret_cast<const char*>(info.ssid), sizeof(conn.ssid) - 1);
+  memcpy(conn.bssid, info.bssid, sizeof(conn.bssid));
+  conn.channel = info.primary;
+  // a user static ip is applied by setSTAConfig, only cache fresh dhcp leases. a reused
+  // lease is never stored again, so the next boot gets a new one from dhcp
+  if(_fastConnectIP && !_sta_static_ip && !_fastConnectReused){
+    conn.ip  = WiFi.localIP();
+    conn.gw  = WiFi.gatewayIP();
+    conn.sn  = WiFi.subnetMask();
+    conn.dns = WiFi.dnsIP();
+  }
+
+  wm_fastconn_t old;
+  Preferences prefs;
+  prefs.begin("wmfast", false);
+  if(prefs.getBytes("conn", &old, sizeof(old)) != sizeof(old) || memcmp(&old, &conn, sizeof(conn)) != 0){
+    prefs.putBytes("conn", &conn, sizeof(conn));
+    #ifdef WM_DEBUG_LEVEL
+    DEBUG_WM(DEBUG_VERBOSE,F("fastConnect: stored channel"),(String)conn.channel);
+    #endif
+  }
+  prefs.end();
+}
+
+void WiFiManager::clearFastConnect(){
+  Preferences prefs;
+  prefs.begin("wmfast", false);
+  prefs.remove("conn");
+  prefs.end();
+}
+#endif
+
 // @todo change to getLastFailureReason and do not touch conxresult
 void WiFiManager::updateConxResult(uint8_t status){
   // hack in wrong password detection
@@ -2424,6 +2538,7 @@ void WiFiManager::resetSettings() {
   
   #ifdef ESP32
     WiFi.disconnect(true,true);
+    clearFastConnect();
   #else
     WiFi.persistent(true);
     WiFi.disconnect(true);
@@ -2783,6 +2898,23 @@ void WiFiManager::setEnableConfigPortal(boolean enable)
     _enableConfigPortal = enable;
 }
 
+/**
+ * toggle fast connect in autoconnect
+ * if enabled, autoconnect first connects directly to the bssid and channel of the last
+ * good connection, with its dhcp lease as static ip if reuseIP, and falls back to a
+ * full scan and dhcp on failure. a reused lease is not renewed for the session and is
+ * used for one boot only, the next boot asks dhcp again.
+ * @since $dev
+ * @access public
+ * @param boolean enabled [true]
+ * @param boolean reuseIP [false]
+ */
+void WiFiManager::setFastConnect(boolean enabled, boolean reuseIP)
+{
+    _fastConnect   = enabled;
+    _fastConnectIP = reuseIP;
+}
+
 
 /**
  * set the hostname (dhcp client id)
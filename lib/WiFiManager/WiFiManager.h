@@ -65,6 +65,7 @@
     #include <WiFi.h>
     #include <esp_wifi.h>  
     #include <Update.h>
+    #include <Preferences.h>
     
     #define WIFI_getChipId() (uint32_t)ESP.getEfuseMac()
     #define WM_WIFIOPEN   WIFI_AUTH_OPEN
@@ -298,6 +299,9 @@ class WiFiManager
     
     // if true (default) then start the config portal from autoConnect if connection failed
     void          setEnableConfigPortal(boolean enable);
+
+    // if true (default) autoConnect first tries the last good bssid/channel, and its ip lease if reuseIP (off by default), esp32 only
+    void          setFastConnect(boolean enabled, boolean reuseIP = false);
     
     // set a custom hostname, sets sta and ap dhcp client id for esp32, and sta for esp8266
     bool          setHostname(const char * hostname);
@@ -470,6 +474,10 @@ class WiFiManager
     boolean       _showInfoUpdate         = true;  // info page update button
     boolean       _showBack               = false; // show back button
     boolean       _enableConfigPortal     = true;  // use config portal if autoconnect failed
+    boolean       _fastConnect            = true;  // try cached bssid/channel before a full connect
+    boolean       _fastConnectIP          = false; // reuse the cached ip lease as static config on fast connect
+    boolean       _fastConnectReused      = false; // this connection runs on a reused lease, not a fresh one
+    unsigned long _fastConnectTimeout     = 3000;  // ms before falling back to a full connect
     const char *  _hostname               = "";    // hostname for esp8266 for dhcp, and or MDNS
 
     const char*   _customHeadElement      = ""; // store custom head element html from user
@@ -522,6 +530,23 @@ class WiFiManager
     uint8_t       waitForConnectResult(uint32_t timeout);
     void          updateConxResult(uint8_t status);
 
+    #ifdef ESP32
+    // last good connection, kept in nvs by storeFastConnect
+    typedef struct {
+      char        ssid[33];
+      uint8_t     bssid[6];
+      uint8_t     channel;
+      uint32_t    ip;
+      uint32_t    gw;
+      uint32_t    sn;
+      uint32_t    dns;
+    } wm_fastconn_t;
+
+    bool          fastConnect();
+    void          storeFastConnect();
+    void          clearFastConnect();
+    #endif
+
     // webserver handlers
     void          handleRoot();
     void          handleWifi(boolean scan);
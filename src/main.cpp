@@ -13,7 +13,6 @@
 #include <ArduinoJson.h>
 #include "Asvin.h"
 #include <time.h> //ESP32 NTP
-#include <mbedtls/md.h> //ESP32 crypto
 #include <WiFi.h>
 #include <credentials.h>
 #include "WiFiManager.h"
@@ -29,6 +28,17 @@ const char* ntpServer = "europe.pool.ntp.org";
 const long  gmtOffset_sec = 3600;
 const int   daylightOffset_sec = 0;
 
+// local hour at which a staged update is activated
+const int maintenance_hour = 3;
+
+// check for rollouts from deep sleep instead of polling, for battery powered devices
+//#define LOW_POWER_MODE
+const uint32_t check_interval_sec = 3600;
+
+// run the asvin work in its own task, loop() stays free for the application
+//#define UPDATE_TASK
+const uint32_t service_check_ms = 60000;
+
 String key = "3";
 String firmware_version = "1.0.0";
 
@@ -38,10 +48,88 @@ String device_key = DEVICE_KEY;
 
 bool device_registered = false;
 
+AsvinSigner signer;
+#ifdef UPDATE_TASK
+AsvinService service;
+#endif
+
+// boot to first request profile, once per boot
+void reportStartup() {
+  static bool reported = false;
+  if (!reported && asvinStartup.reached(ASVIN_STARTUP_FIRST_REQUEST)) {
+    asvinStartup.print(Serial);
+    reported = true;
+  }
+}
+
+#ifdef LOW_POWER_MODE
+// a revoked or expired token is logged in again on the next wake-up
+void tokenRejected(int httpCode) {
+  if (httpCode == 401 || httpCode == 403) {
+    AsvinSleep::setToken("");
+  }
+}
+
+// one rollout check with the token and registration kept in RTC memory
+bool rolloutPending() {
+  Asvin asvin;
+  int httpCode;
+  if (!asvinClock.valid() && !asvin.fetchServerTime()) {
+    return false;
+  }
+  String token = AsvinSleep::token();
+  if (token.length() == 0) {
+    unsigned long timestr = asvinClock.now();
+    String response = asvin.authLogin(device_key, signer.sign(timestr, device_key), timestr, httpCode);
+    DynamicJsonDocument doc(1000);
+    if (deserializeJson(doc, response) || !doc["token"]) {
+      return false;
+    }
+    token = doc["token"].as<String>();
+    AsvinSleep::setToken(token);
+  }
+  String mac = WiFi.macAddress();
+  if (!AsvinSleep::registered()) {
+    asvin.registerDevice("demo-device", mac, firmware_version, token, httpCode);
+    if (httpCode != 200) {
+      tokenRejected(httpCode);
+      return false;
+    }
+    AsvinSleep::setRegistered(true);
+  }
+  String rollout = asvin.checkRollout(mac, firmware_version, token, httpCode);
+  // a wake-up with a cached token has no login, the rollout check is its first request
+  reportStartup();
+  DynamicJsonDocument doc(1000);
+  if (httpCode != 200 || deserializeJson(doc, rollout)) {
+    tokenRejected(httpCode);
+    return false;
+  }
+  String rolloutID = doc["rollout_id"];
+  if (rolloutID == "null") {
+    return false;
+  }
+  // sleep through the wait for this device's download slot
+  uint32_t wait = asvin.rolloutSlotDelay(rollout, mac);
+  if (wait) {
+    Serial.printf("Rollout slot in %u s\n", wait);
+    AsvinSleep::sleep(wait);
+  }
+  return true;
+}
+#endif
+
 void setup()
 {
+  asvinStartup.begin();
   Serial.begin(115200); //Serial connection
   delay(500);
+  signer.begin(customer_key);
+#ifdef LOW_POWER_MODE
+  if (AsvinSleep::begin()) {
+    Serial.printf("Wake-up %u, previous cycle awake for %u ms\n", AsvinSleep::wakeCount(), AsvinSleep::lastAwakeTime());
+  }
+#endif
 
   WiFiManager wifiManager;
   //Uncomment below code to reset onboard wifi credentials
@@ -57,8 +145,26 @@ void setup()
   }
   */
   Serial.println("Connected to the WiFi network");
-  configTime(gmtOffset_sec, daylightOffset_sec, ntpServer); //init and get the time
+  asvinClock.begin(ntpServer, gmtOffset_sec, daylightOffset_sec); //SNTP once, it re-syncs by itself
 
+  uint32_t activationTime = HTTPUpdate::getActivationTime();
+  if (activationTime) {
+    Serial.printf("Update activated in %u ms\n", activationTime);
+  }
+#ifdef LOW_POWER_MODE
+  // the next wake-up boots an installed update, no staging needed
+  if (!rolloutPending()) {
+    AsvinSleep::sleep(check_interval_sec);
+  }
+#else
+  // download while the application runs, reboot only in the maintenance window
+  httpUpdate.setStageOnly(true);
+#ifdef UPDATE_TASK
+  if (!service.begin("demo-device", device_key, customer_key, firmware_version)) {
+    Serial.println("Starting the update service failed");
+  }
+#endif
+#endif
 }
 
 void loop() {
@@ -73,56 +179,85 @@ void loop() {
 
   */
 
+#ifdef LOW_POWER_MODE
+  // a rollout was pending, one full pass and back to sleep
+  static bool updateRan = false;
+  if (updateRan) {
+    AsvinSleep::sleep(check_interval_sec);
+  }
+  updateRan = true;
+#endif
+
+#ifdef UPDATE_TASK
+  // the service task talks to asvin, here it is only scheduled and its events printed
+  static bool staged = false;
+  static unsigned long lastCheck = 0;
+  asvin_status_t status;
+  while (service.status(status)) {
+    Serial.printf("Update service: %s (%d)\n", AsvinService::eventName(status.event), status.code);
+    if (status.event == ASVIN_SERVICE_INSTALLED || status.event == ASVIN_SERVICE_STAGED) {
+      // also reported at startup for an image staged before the reboot
+      staged = true;
+    }
+  }
+  reportStartup();
+  struct tm now;
+  if (staged && asvinClock.localTime(&now) && now.tm_hour == maintenance_hour) {
+    Serial.println("--Restart Device and Apply Update : OK");
+    service.activate();
+    staged = false;
+  }
+  if (!staged && (lastCheck == 0 || millis() - lastCheck >= service_check_ms)) {
+    service.check();
+    lastCheck = millis();
+  }
+  delay(100);
+  return;
+#endif
+
   if (WiFi.status() == WL_CONNECTED) { //Check WiFi connection status
     //Serial.println("Wifi Connected !");
     delay(500);
     //Serial.println("Getting Unix timestamp from NTP");
-    configTime(gmtOffset_sec, daylightOffset_sec, ntpServer); //init and get the time
+    Asvin asvin;
     struct tm timeinfo;
-    while (!getLocalTime(&timeinfo)) {
-      Serial.print("..\n");
-      delay(500);
+    if (!asvinClock.localTime(&timeinfo)) {
+      // SNTP has not answered yet, the server's Date header will do
+      asvin.fetchServerTime();
+      if (!asvinClock.localTime(&timeinfo)) {
+        Serial.println("Time not available yet");
+        delay(1000);
+        return;
+      }
     }
-    time_t now;
-    time(&now);
-    unsigned long timestr = now;
-    //Serial.println(timestr);
+    unsigned long timestr = asvinClock.now();
 
-    //HMAC mbedtls
-    char payload[10 + strlen(device_key.c_str())] = "";
-    byte hmacResult[32];
-    ltoa(timestr, payload, 10);
-    strcat(payload, device_key.c_str());
-    mbedtls_md_context_t ctx;
-    mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
-
-    mbedtls_md_init(&ctx);
-    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(md_type), 1);
-    mbedtls_md_hmac_starts(&ctx, (const unsigned char*)customer_key.c_str(), strlen(customer_key.c_str()));
-    mbedtls_md_hmac_update(&ctx, (const unsigned char*)payload, strlen(payload));
-    mbedtls_md_hmac_finish(&ctx, hmacResult);
-    mbedtls_md_free(&ctx);
-
-    String device_signature = "";
-    for (int i = 0; i < sizeof(hmacResult); i++) {
-      char str[3];
-      sprintf(str, "%02x", (int)hmacResult[i]);
-      //Serial.print(str);
-      device_signature += str;
+    if (httpUpdate.hasStagedUpdate()) {
+      if (timeinfo.tm_hour == maintenance_hour) {
+        Serial.println("--Restart Device and Apply Update : OK");
+        httpUpdate.activateUpdate();
+        Serial.printf("Activation failed (%d): %s\n", httpUpdate.getLastError(), httpUpdate.getLastErrorString().c_str());
+      }
+      delay(1000 * 60);
+      return;
     }
+    //Serial.println(timestr);
+
+    //HMAC over timestamp and device key, keyed once in setup()
+    String device_signature = signer.sign(timestr, device_key);
     //Serial.print("Hash: ");
     //Serial.println(device_signature);
 
     delay(2000);
     HTTPClient http;
     String mac = WiFi.macAddress();
-    Asvin asvin;
     int httpCode;
 
     // ......Get OAuth Token.................. 
     Serial.println("Get OAuth Token ");
 
     String response = asvin.authLogin(device_key, device_signature, timestr, httpCode);
+    reportStartup();
     //Serial.print("response: ");
     //Serial.println("Parsing Auth Code ");
     DynamicJsonDocument doc(1000);
@@ -184,6 +319,14 @@ void loop() {
           return;
         }
 
+        // spread the downloads of a rollout over its window instead of all starting at once
+        uint32_t wait = asvin.rolloutSlotDelay(resultCheckout, mac);
+        if (wait) {
+          Serial.printf("Rollout slot in %u s\n", wait);
+          delay(1000 * (wait < 60 ? wait : 60));
+          return;
+        }
+
         // Get CID from BlockChain server
         Serial.println("--Get Firmware Info from Blockchain");
         String CidResponse = asvin.getBlockchainCID(firmwareID, authToken, httpCode);
@@ -216,22 +359,27 @@ void loop() {
             break;
           case HTTP_UPDATE_NO_UPDATES:
             Serial.println("HTTP_UPDATE_NO_UPDATES");
+            // the image is already running or staged, report it so the rollout is not retried
+            asvin.reportRollout(mac, firmware_version, authToken, rolloutID, ret, httpCode, cid);
             break;
           case HTTP_UPDATE_OK:
-            Serial.println("HTTP_UPDATE_OK");
+            Serial.printf("HTTP_UPDATE_OK, written in %u ms\n", httpUpdate.getStageTime());
             // check if rollout successfull 
             //Serial.println("--Update Rollout");
-            String resultCheckout = asvin.checkRolloutSuccess(mac, firmware_version, authToken, rolloutID, httpCode);
-            char buff[resultCheckout.length() + 1];
-            resultCheckout.toCharArray(buff, resultCheckout.length() + 1);
-            //Serial.println(buff);
-            if (httpCode == 200) {
+            // sent once the image runs, after the activation in the maintenance window
+            if (asvin.reportRollout(mac, firmware_version, authToken, rolloutID, ret, httpCode, cid)) {
               //Serial.println("Update Rollout : OK");
-              Serial.println("--Restart Device and Apply Update : OK");
-              ESP.restart();
             }
             else {
-              Serial.println("Rollout Update Error!!");
+              // kept in flash, sent again with the next rollout check
+              Serial.printf("Rollout Update Error (%d), %u report(s) pending\n", httpCode, asvinReports.pending());
+            }
+            // only stage only mode holds the image back, otherwise it is the boot partition already
+            if (httpUpdate.hasStagedUpdate()) {
+              Serial.printf("--Update staged, applying it at %02d:00\n", maintenance_hour);
+            }
+            else {
+              Serial.println("--Update installed, it runs after the next restart");
             }
             break;
           }
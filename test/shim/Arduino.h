@@ -0,0 +1,69 @@
+/**
+ * Arduino.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___ARDUINO_SHIM_H___
+#define ___ARDUINO_SHIM_H___
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+/**
+ * host stand-in for the parts of the Arduino core the native tests build
+ *
+ * String only has what the tested sources use; logging goes nowhere.
+ */
+
+#define log_e(...)
+#define log_w(...)
+#define log_i(...)
+#define log_d(...)
+
+class String
+{
+public:
+    String(const char* s = "") : _s(s ? s : "") {}
+
+    const char* c_str(void) const
+    {
+        return _s.c_str();
+    }
+
+    size_t length(void) const
+    {
+        return _s.length();
+    }
+
+    bool endsWith(const char* suffix) const
+    {
+        size_t n = strlen(suffix);
+        return _s.length() >= n && _s.compare(_s.length() - n, n, suffix) == 0;
+    }
+
+    void remove(unsigned int index)
+    {
+        if(index < _s.length()) {
+            _s.erase(index);
+        }
+    }
+
+    bool operator==(const String& other) const
+    {
+        return _s == other._s;
+    }
+
+    /// like the core, an integer is appended as its decimal text
+    friend String operator+(const String& s, unsigned char num)
+    {
+        return String((s._s + std::to_string(num)).c_str());
+    }
+
+private:
+    std::string _s;
+};
+
+#endif /* ___ARDUINO_SHIM_H___ */
@@ -0,0 +1,104 @@
+/**
+ * Preferences.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___PREFERENCES_SHIM_H___
+#define ___PREFERENCES_SHIM_H___
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * host stand-in for the Arduino-ESP32 Preferences (NVS) class
+ *
+ * all instances share one in-memory store that lives until clear(), so a
+ * test can "reboot" by building a new object on the same store. As on the
+ * device, a read-only begin fails for a namespace that was never written.
+ */
+class Preferences
+{
+public:
+    typedef std::map<std::string, std::vector<uint8_t>> Namespace;
+
+    bool begin(const char* name, bool readOnly = false)
+    {
+        if(readOnly && store().find(name) == store().end()) {
+            return false;
+        }
+        _ns = &store()[name];
+        _readOnly = readOnly;
+        return true;
+    }
+
+    void end(void)
+    {
+        _ns = NULL;
+    }
+
+    bool remove(const char* key)
+    {
+        return _ns && !_readOnly && _ns->erase(key) > 0;
+    }
+
+    uint8_t getUChar(const char* key, uint8_t value = 0)
+    {
+        uint8_t v;
+        return (getBytes(key, &v, sizeof(v)) == sizeof(v)) ? v : value;
+    }
+
+    size_t putUChar(const char* key, uint8_t value)
+    {
+        return putBytes(key, &value, sizeof(value));
+    }
+
+    size_t getBytes(const char* key, void* buf, size_t len)
+    {
+        if(!_ns || _ns->find(key) == _ns->end()) {
+            return 0;
+        }
+        const std::vector<uint8_t>& v = (*_ns)[key];
+        if(v.size() > len) {
+            return 0;
+        }
+        memcpy(buf, v.data(), v.size());
+        return v.size();
+    }
+
+    size_t putBytes(const char* key, const void* value, size_t len)
+    {
+        if(!_ns || _readOnly) {
+            return 0;
+        }
+        const uint8_t* p = (const uint8_t *) value;
+        (*_ns)[key] = std::vector<uint8_t>(p, p + len);
+        return len;
+    }
+
+    /// the namespace as stored, for tests that look at or damage records
+    static Namespace& raw(const char* name)
+    {
+        return store()[name];
+    }
+
+    static void clear(void)
+    {
+        store().clear();
+    }
+
+private:
+    static std::map<std::string, Namespace>& store(void)
+    {
+        static std::map<std::string, Namespace> nvs;
+        return nvs;
+    }
+
+    Namespace* _ns = NULL;
+    bool _readOnly = false;
+};
+
+#endif /* ___PREFERENCES_SHIM_H___ */
@@ -0,0 +1,58 @@
+/**
+ * Stream.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___STREAM_SHIM_H___
+#define ___STREAM_SHIM_H___
+
+#include <Arduino.h>
+
+/**
+ * host stand-in for the Stream of the Arduino core
+ *
+ * blocking reads without a timeout, a source that runs dry simply returns short.
+ */
+class Stream
+{
+public:
+    virtual ~Stream(void)
+    {
+    }
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t) = 0;
+
+    virtual void flush()
+    {
+    }
+
+    virtual size_t readBytes(char *buffer, size_t length)
+    {
+        size_t count = 0;
+        int c;
+        while(count < length && (c = read()) >= 0) {
+            buffer[count++] = (char) c;
+        }
+        return count;
+    }
+
+    size_t readBytes(uint8_t *buffer, size_t length)
+    {
+        return readBytes((char *) buffer, length);
+    }
+
+    String readStringUntil(char terminator)
+    {
+        std::string s;
+        int c;
+        while((c = read()) >= 0 && c != terminator) {
+            s += (char) c;
+        }
+        return String(s.c_str());
+    }
+};
+
+#endif /* ___STREAM_SHIM_H___ */
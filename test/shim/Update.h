@@ -0,0 +1,198 @@
+/**
+ * Update.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___UPDATE_SHIM_H___
+#define ___UPDATE_SHIM_H___
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "FlashModel.h"
+
+/**
+ * host stand-in for the Arduino-ESP32 Update class of the native build
+ *
+ * same calls, error codes and 4 KB sector buffering as the real one, but
+ * the sectors go to a FlashModel, so write strategies can be measured
+ * without a device: the model counts erases and page programs and, with
+ * store, keeps the image for comparison.
+ */
+
+#define UPDATE_ERROR_OK                 (0)
+#define UPDATE_ERROR_WRITE              (1)
+#define UPDATE_ERROR_ERASE              (2)
+#define UPDATE_ERROR_READ               (3)
+#define UPDATE_ERROR_SPACE              (4)
+#define UPDATE_ERROR_SIZE               (5)
+#define UPDATE_ERROR_STREAM             (6)
+#define UPDATE_ERROR_MD5                (7)
+#define UPDATE_ERROR_MAGIC_BYTE         (8)
+#define UPDATE_ERROR_ACTIVATE           (9)
+#define UPDATE_ERROR_NO_PARTITION       (10)
+#define UPDATE_ERROR_BAD_ARGUMENT       (11)
+#define UPDATE_ERROR_ABORT              (12)
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+
+#define U_FLASH   0
+#define U_SPIFFS  100
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+
+class UpdateClass
+{
+public:
+    /// the flash every following update writes to
+    void setModel(FlashModel* model)
+    {
+        _model = model;
+    }
+
+    bool begin(size_t size = UPDATE_SIZE_UNKNOWN, int command = U_FLASH, int ledPin = -1, uint8_t ledOn = 0)
+    {
+        (void) ledPin;
+        (void) ledOn;
+        if(_size > 0) {
+            return false;
+        }
+        _error = UPDATE_ERROR_OK;
+        _command = command;
+        _progress = 0;
+        _bufferLen = 0;
+        if(!_model) {
+            _error = UPDATE_ERROR_NO_PARTITION;
+            return false;
+        }
+        if(size == UPDATE_SIZE_UNKNOWN) {
+            size = _model->size();
+        } else if(size == 0 || size > _model->size()) {
+            _error = UPDATE_ERROR_SIZE;
+            return false;
+        }
+        if(!_model->begin(size == _model->size() ? 0 : size)) {
+            _error = UPDATE_ERROR_ERASE;
+            return false;
+        }
+        _size = size;
+        return true;
+    }
+
+    size_t write(uint8_t *data, size_t len)
+    {
+        if(hasError() || !isRunning()) {
+            return 0;
+        }
+        if(len > remaining()) {
+            abort(UPDATE_ERROR_SPACE);
+            return 0;
+        }
+        size_t left = len;
+        while(left > 0) {
+            size_t n = FLASH_MODEL_SECTOR_SIZE - _bufferLen;
+            if(n > left) {
+                n = left;
+            }
+            memcpy(_buffer + _bufferLen, data + (len - left), n);
+            _bufferLen += n;
+            left -= n;
+            if((_bufferLen == FLASH_MODEL_SECTOR_SIZE || _bufferLen == remaining()) && !writeBuffer()) {
+                return 0;
+            }
+        }
+        return len;
+    }
+
+    bool end(bool evenIfRemaining = false)
+    {
+        if(hasError() || _size == 0) {
+            return false;
+        }
+        if(!isFinished() && !evenIfRemaining) {
+            abort(UPDATE_ERROR_ABORT);
+            return false;
+        }
+        if(evenIfRemaining && _bufferLen > 0 && !writeBuffer()) {
+            return false;
+        }
+        _size = 0;
+        return true;
+    }
+
+    void abort(void)
+    {
+        abort(UPDATE_ERROR_ABORT);
+    }
+
+    bool isRunning(void)
+    {
+        return _size > 0;
+    }
+
+    bool isFinished(void)
+    {
+        return _progress == _size;
+    }
+
+    bool hasError(void)
+    {
+        return _error != UPDATE_ERROR_OK;
+    }
+
+    uint8_t getError(void)
+    {
+        return _error;
+    }
+
+    size_t size(void)
+    {
+        return _size;
+    }
+
+    size_t progress(void)
+    {
+        return _progress;
+    }
+
+    size_t remaining(void)
+    {
+        return _size - _progress;
+    }
+
+private:
+    void abort(uint8_t error)
+    {
+        _error = error;
+        _size = 0;
+        _bufferLen = 0;
+    }
+
+    bool writeBuffer(void)
+    {
+        // like the real one, an app image has to start with the magic byte
+        if(_progress == 0 && _command == U_FLASH && _buffer[0] != ESP_IMAGE_HEADER_MAGIC) {
+            abort(UPDATE_ERROR_MAGIC_BYTE);
+            return false;
+        }
+        if(_model->write(_buffer, _bufferLen) != _bufferLen) {
+            abort(UPDATE_ERROR_WRITE);
+            return false;
+        }
+        _progress += _bufferLen;
+        _bufferLen = 0;
+        return true;
+    }
+
+    FlashModel* _model = NULL;
+    uint8_t _buffer[FLASH_MODEL_SECTOR_SIZE];
+    size_t _bufferLen = 0;
+    size_t _size = 0;
+    size_t _progress = 0;
+    int _command = U_FLASH;
+    uint8_t _error = UPDATE_ERROR_OK;
+};
+
+inline UpdateClass Update;
+
+#endif /* ___UPDATE_SHIM_H___ */
@@ -0,0 +1,110 @@
+/**
+ * miniz.h
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#ifndef ___MINIZ_SHIM_H___
+#define ___MINIZ_SHIM_H___
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * host stand-in for the tinfl decoder in the ESP32 ROM
+ *
+ * only inflates stored (uncompressed) deflate blocks, which is enough to
+ * drive GzipStream through block, read and trailer boundaries; whole bytes
+ * are consumed, so nothing is left in the bit buffer at the end.
+ */
+
+#define TINFL_LZ_DICT_SIZE          (32768)
+#define TINFL_FLAG_HAS_MORE_INPUT   (2)
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+struct tinfl_decompressor_tag {
+    uint64_t m_bit_buf;
+    uint32_t m_num_bits;
+    uint8_t m_header[5];
+    size_t m_headerLen;
+    size_t m_remaining;
+    bool m_inBlock;
+    bool m_final;
+    bool m_done;
+};
+typedef struct tinfl_decompressor_tag tinfl_decompressor;
+
+#define tinfl_init(r) memset((r), 0, sizeof(tinfl_decompressor))
+
+static inline tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in, size_t* inSize, uint8_t* outStart,
+        uint8_t* outNext, size_t* outSize, uint32_t flags)
+{
+    size_t inPos = 0;
+    size_t outPos = 0;
+    tinfl_status status = TINFL_STATUS_DONE;
+    (void) outStart;
+
+    while(!r->m_done) {
+        if(!r->m_inBlock) {
+            // BFINAL, BTYPE 00 and padding in one byte, then LEN and NLEN
+            if(r->m_headerLen < sizeof(r->m_header)) {
+                if(inPos == *inSize) {
+                    status = TINFL_STATUS_NEEDS_MORE_INPUT;
+                    break;
+                }
+                r->m_header[r->m_headerLen++] = in[inPos++];
+                continue;
+            }
+            uint16_t len = r->m_header[1] | (r->m_header[2] << 8);
+            uint16_t nlen = r->m_header[3] | (r->m_header[4] << 8);
+            if((r->m_header[0] & 0x06) != 0 || (uint16_t) ~nlen != len) {
+                status = TINFL_STATUS_FAILED;
+                break;
+            }
+            r->m_final = r->m_header[0] & 0x01;
+            r->m_remaining = len;
+            r->m_headerLen = 0;
+            r->m_inBlock = true;
+        }
+        if(r->m_remaining == 0) {
+            r->m_inBlock = false;
+            r->m_done = r->m_final;
+            continue;
+        }
+        if(outPos == *outSize) {
+            status = TINFL_STATUS_HAS_MORE_OUTPUT;
+            break;
+        }
+        if(inPos == *inSize) {
+            status = TINFL_STATUS_NEEDS_MORE_INPUT;
+            break;
+        }
+        size_t n = r->m_remaining;
+        if(n > *outSize - outPos) {
+            n = *outSize - outPos;
+        }
+        if(n > *inSize - inPos) {
+            n = *inSize - inPos;
+        }
+        memcpy(outNext + outPos, in + inPos, n);
+        inPos += n;
+        outPos += n;
+        r->m_remaining -= n;
+    }
+    if(status == TINFL_STATUS_NEEDS_MORE_INPUT && !(flags & TINFL_FLAG_HAS_MORE_INPUT)) {
+        status = TINFL_STATUS_FAILED;
+    }
+    *inSize = inPos;
+    *outSize = outPos;
+    return status;
+}
+
+#endif /* ___MINIZ_SHIM_H___ */
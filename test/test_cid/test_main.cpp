@@ -0,0 +1,143 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include <string.h>
+#include "Cid.cpp"
+
+// sha2-256 of the empty string
+static const uint8_t emptyDigest[32] = {
+    0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+    0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55
+};
+
+#define CID_V0      "QmYwAPJzv5CZsnA625s3Xf2nemtYgPpHdWEz79ojWnPbdG"
+#define CID_V0_V1   "bafybeie5nqv6kd3qnfjupgvz34woh3oksc3iau6abmyajn7qvtf6d2ho34"
+#define CID_RAW     "bafkreihdwdcefgh4dqkjv67uzcmw7ojee6xedzdetojuzjevtenxquvyku"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_varint(void)
+{
+    const uint8_t p[] = { 0x01, 0xac, 0x02, 0xff, 0xff, 0x03 };
+    size_t pos = 0;
+    uint64_t value;
+    TEST_ASSERT_TRUE(cidVarint(p, sizeof(p), pos, value));
+    TEST_ASSERT_EQUAL(1, value);
+    TEST_ASSERT_TRUE(cidVarint(p, sizeof(p), pos, value));
+    TEST_ASSERT_EQUAL(300, value);
+    TEST_ASSERT_TRUE(cidVarint(p, sizeof(p), pos, value));
+    TEST_ASSERT_EQUAL(0xffff, value);
+    TEST_ASSERT_EQUAL(sizeof(p), pos);
+}
+
+void test_varint_truncated(void)
+{
+    const uint8_t p[] = { 0x80, 0x80 };
+    size_t pos = 0;
+    uint64_t value;
+    TEST_ASSERT_FALSE(cidVarint(p, sizeof(p), pos, value));
+}
+
+void test_raw_cid(void)
+{
+    uint8_t bytes[CID_MAX_BYTES];
+    uint8_t len = 0;
+    TEST_ASSERT_TRUE(cidFromText(CID_RAW, bytes, len));
+    TEST_ASSERT_EQUAL(36, len);
+
+    uint64_t codec = 0;
+    const uint8_t* digest = NULL;
+    TEST_ASSERT_EQUAL(36, cidParse(bytes, len, codec, &digest));
+    TEST_ASSERT_EQUAL(CID_CODEC_RAW, codec);
+    TEST_ASSERT_EQUAL_MEMORY(emptyDigest, digest, sizeof(emptyDigest));
+}
+
+void test_v0_cid(void)
+{
+    uint8_t bytes[CID_MAX_BYTES];
+    uint8_t len = 0;
+    TEST_ASSERT_TRUE(cidFromText(CID_V0, bytes, len));
+    TEST_ASSERT_EQUAL(34, len);
+    TEST_ASSERT_EQUAL(MULTIHASH_SHA2_256, bytes[0]);
+    TEST_ASSERT_EQUAL(32, bytes[1]);
+
+    uint64_t codec = 0;
+    const uint8_t* digest = NULL;
+    TEST_ASSERT_EQUAL(34, cidParse(bytes, len, codec, &digest));
+    TEST_ASSERT_EQUAL(CID_CODEC_DAG_PB, codec);
+    TEST_ASSERT_TRUE(digest == bytes + 2);
+}
+
+void test_to_text(void)
+{
+    uint8_t bytes[CID_MAX_BYTES];
+    uint8_t len = 0;
+    char text[CID_MAX_TEXT];
+    TEST_ASSERT_TRUE(cidFromText(CID_RAW, bytes, len));
+    cidToText(bytes, len, text);
+    TEST_ASSERT_EQUAL_STRING(CID_RAW, text);
+    // CIDv0 comes back as the dag-pb CIDv1 of the same multihash
+    TEST_ASSERT_TRUE(cidFromText(CID_V0, bytes, len));
+    cidToText(bytes, len, text);
+    TEST_ASSERT_EQUAL_STRING(CID_V0_V1, text);
+}
+
+void test_rejected(void)
+{
+    uint8_t bytes[CID_MAX_BYTES];
+    uint8_t len = 0;
+    // unknown multibase, bad digits, truncated digest
+    TEST_ASSERT_FALSE(cidFromText("zdj7WWeQ43G6JJvLWQWZpyHuAMq6uYWRjkBXFad11vE2LHhQ7", bytes, len));
+    TEST_ASSERT_FALSE(cidFromText("bafkreihdwdcefgh4dqkjv67uzcmw7ojee6xedzdetojuzjevtenxquvyk1", bytes, len));
+    TEST_ASSERT_FALSE(cidFromText("bafkreihdwdcefgh4dqkjv67uzcmw7ojee6xedzdetojuzjevtenxq", bytes, len));
+    TEST_ASSERT_FALSE(cidFromText("QmYwAPJzv5CZsnA625s3Xf2nemtYgPpHdWEz79ojWnPbd0", bytes, len));
+    TEST_ASSERT_FALSE(cidFromText("", bytes, len));
+    // text longer than a CID
+    TEST_ASSERT_FALSE(cidFromText(CID_RAW "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", bytes, len));
+}
+
+void test_parse_rejects_other_hashes(void)
+{
+    // CIDv1 raw with a sha2-512 multihash
+    uint8_t bytes[4 + 64] = { 0x01, CID_CODEC_RAW, 0x13, 64 };
+    uint64_t codec;
+    const uint8_t* digest;
+    TEST_ASSERT_EQUAL(0, cidParse(bytes, sizeof(bytes), codec, &digest));
+    // CIDv1 cut short inside the digest
+    uint8_t cut[4 + 16] = { 0x01, CID_CODEC_RAW, MULTIHASH_SHA2_256, 32 };
+    TEST_ASSERT_EQUAL(0, cidParse(cut, sizeof(cut), codec, &digest));
+}
+
+void test_raw_sha256(void)
+{
+    uint8_t sha256[32];
+    TEST_ASSERT_TRUE(cidRawSha256(CID_RAW, sha256));
+    TEST_ASSERT_EQUAL_MEMORY(emptyDigest, sha256, sizeof(sha256));
+    // the digest of a dag-pb node is not the digest of the file
+    TEST_ASSERT_FALSE(cidRawSha256(CID_V0, sha256));
+    TEST_ASSERT_FALSE(cidRawSha256(CID_V0_V1, sha256));
+    TEST_ASSERT_FALSE(cidRawSha256("not a cid", sha256));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_varint);
+    RUN_TEST(test_varint_truncated);
+    RUN_TEST(test_raw_cid);
+    RUN_TEST(test_v0_cid);
+    RUN_TEST(test_to_text);
+    RUN_TEST(test_rejected);
+    RUN_TEST(test_parse_rejects_other_hashes);
+    RUN_TEST(test_raw_sha256);
+    return UNITY_END();
+}
@@ -0,0 +1,164 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include <string.h>
+#include "DeltaPatch.cpp"
+
+#define OLD_SIZE    (6000)
+#define NEW_SIZE    (4400)
+#define EXTRA       "a new string table entry"
+
+static uint8_t oldImage[OLD_SIZE];
+static uint8_t newImage[NEW_SIZE];
+static uint8_t result[NEW_SIZE];
+
+// patch bytes of the blocks below, diff bytes are new - old
+static uint8_t patchDiff[NEW_SIZE];
+
+void setUp(void)
+{
+    uint32_t x = 0x2545F491;
+    for(size_t i = 0; i < sizeof(oldImage); i++) {
+        x = x * 1103515245 + 12345;
+        oldImage[i] = x >> 16;
+    }
+    // new image: old [0, 3000) with a few patched bytes, a literal, old [4000, 5376)
+    memcpy(newImage, oldImage, 3000);
+    newImage[10] ^= 0x5a;
+    newImage[2999] += 3;
+    memcpy(newImage + 3000, EXTRA, strlen(EXTRA));
+    memcpy(newImage + 3000 + strlen(EXTRA), oldImage + 4000, NEW_SIZE - 3000 - strlen(EXTRA));
+    memset(result, 0, sizeof(result));
+}
+
+void tearDown(void)
+{
+}
+
+// feed the patch bytes of the current block in chunks, like the download loop
+static void feed(DeltaPatch& patch, const uint8_t* patchBytes, size_t chunk)
+{
+    while(patch.pending() > 0) {
+        size_t n = (patch.pending() > chunk) ? chunk : patch.pending();
+        uint32_t at = patch.written();
+        memcpy(result + at, patchBytes + at, n);
+        patch.apply(result + at, n);
+    }
+}
+
+static void applyPatch(size_t chunk)
+{
+    const size_t extraLen = strlen(EXTRA);
+    const size_t tailLen = NEW_SIZE - 3000 - extraLen;
+    for(size_t i = 0; i < 3000; i++) {
+        patchDiff[i] = newImage[i] - oldImage[i];
+    }
+    memcpy(patchDiff + 3000, EXTRA, extraLen);
+    for(size_t i = 0; i < tailLen; i++) {
+        patchDiff[3000 + extraLen + i] = newImage[3000 + extraLen + i] - oldImage[4000 + i];
+    }
+
+    DeltaPatch patch(oldImage, OLD_SIZE, NEW_SIZE);
+    const delta_control_t blocks[] = {
+        { 3000, (uint32_t) extraLen, 1000 },
+        { (uint32_t) tailLen, 0, 0 }
+    };
+    for(const delta_control_t& control : blocks) {
+        TEST_ASSERT_FALSE(patch.finished());
+        TEST_ASSERT_TRUE(patch.control(control));
+        feed(patch, patchDiff, chunk);
+        TEST_ASSERT_TRUE(patch.seek());
+    }
+    TEST_ASSERT_TRUE(patch.finished());
+    TEST_ASSERT_EQUAL(NEW_SIZE, patch.written());
+    TEST_ASSERT_EQUAL_MEMORY(newImage, result, NEW_SIZE);
+}
+
+void test_patch_rebuilds_image(void)
+{
+    applyPatch(512);
+}
+
+void test_chunk_size_does_not_matter(void)
+{
+    applyPatch(1);
+    memset(result, 0, sizeof(result));
+    applyPatch(7);
+    memset(result, 0, sizeof(result));
+    applyPatch(NEW_SIZE);
+}
+
+void test_pending_diff_then_extra(void)
+{
+    DeltaPatch patch(oldImage, OLD_SIZE, NEW_SIZE);
+    delta_control_t control = { 100, 20, 0 };
+    TEST_ASSERT_TRUE(patch.control(control));
+    uint8_t buf[100];
+    memset(buf, 0, sizeof(buf));
+    TEST_ASSERT_EQUAL(100, patch.pending());
+    // a chunk never runs from the diff into the extra part
+    patch.apply(buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_MEMORY(oldImage, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL(20, patch.pending());
+    // no new block and no seek while the current one is open
+    TEST_ASSERT_FALSE(patch.control(control));
+    TEST_ASSERT_FALSE(patch.seek());
+}
+
+void test_block_past_new_image(void)
+{
+    DeltaPatch patch(oldImage, OLD_SIZE, NEW_SIZE);
+    delta_control_t diff = { NEW_SIZE + 1, 0, 0 };
+    delta_control_t extra = { NEW_SIZE - 10, 11, 0 };
+    delta_control_t wrap = { 10, 0xfffffff8, 0 };
+    TEST_ASSERT_FALSE(patch.control(diff));
+    TEST_ASSERT_FALSE(patch.control(extra));
+    TEST_ASSERT_FALSE(patch.control(wrap));
+}
+
+void test_diff_past_old_image(void)
+{
+    DeltaPatch patch(oldImage, 100, NEW_SIZE);
+    delta_control_t control = { 101, 0, 0 };
+    TEST_ASSERT_FALSE(patch.control(control));
+}
+
+void test_seek_outside_old_image(void)
+{
+    uint8_t buf[50];
+    DeltaPatch patch(oldImage, OLD_SIZE, NEW_SIZE);
+    delta_control_t back = { 50, 0, -51 };
+    TEST_ASSERT_TRUE(patch.control(back));
+    patch.apply(buf, sizeof(buf));
+    TEST_ASSERT_FALSE(patch.seek());
+
+    DeltaPatch ahead(oldImage, OLD_SIZE, NEW_SIZE);
+    delta_control_t forward = { 50, 0, OLD_SIZE - 50 + 1 };
+    TEST_ASSERT_TRUE(ahead.control(forward));
+    ahead.apply(buf, sizeof(buf));
+    TEST_ASSERT_FALSE(ahead.seek());
+
+    // up to the end of the old image is fine, the next block then has nothing to diff against
+    DeltaPatch end(oldImage, OLD_SIZE, NEW_SIZE);
+    delta_control_t toEnd = { 50, 0, OLD_SIZE - 50 };
+    delta_control_t more = { 1, 0, 0 };
+    TEST_ASSERT_TRUE(end.control(toEnd));
+    end.apply(buf, sizeof(buf));
+    TEST_ASSERT_TRUE(end.seek());
+    TEST_ASSERT_FALSE(end.control(more));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_patch_rebuilds_image);
+    RUN_TEST(test_chunk_size_does_not_matter);
+    RUN_TEST(test_pending_diff_then_extra);
+    RUN_TEST(test_block_past_new_image);
+    RUN_TEST(test_diff_past_old_image);
+    RUN_TEST(test_seek_outside_old_image);
+    return UNITY_END();
+}
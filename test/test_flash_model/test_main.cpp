@@ -0,0 +1,149 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include <Update.h>
+// the ESP32 libraries are ignored in the native build, the host independent sources come in here
+#include "FlashModel.cpp"
+
+#define MODEL_SIZE  (16 * FLASH_MODEL_SECTOR_SIZE)
+#define IMAGE_SIZE  (20000)
+
+static uint8_t image[IMAGE_SIZE];
+
+static void makeImage(uint8_t seed)
+{
+    uint32_t x = 0x12345678 + seed;
+    for(size_t i = 0; i < sizeof(image); i++) {
+        x = x * 1103515245 + 12345;
+        image[i] = x >> 16;
+    }
+    image[0] = ESP_IMAGE_HEADER_MAGIC;
+}
+
+static bool writeImage(size_t chunk, size_t size = IMAGE_SIZE)
+{
+    if(!Update.begin(size)) {
+        return false;
+    }
+    for(size_t done = 0; done < IMAGE_SIZE; done += chunk) {
+        size_t n = (IMAGE_SIZE - done > chunk) ? chunk : IMAGE_SIZE - done;
+        if(Update.write(image + done, n) != n) {
+            return false;
+        }
+    }
+    return Update.end(size == UPDATE_SIZE_UNKNOWN);
+}
+
+void setUp(void)
+{
+    makeImage(0);
+}
+
+void tearDown(void)
+{
+    Update.setModel(NULL);
+}
+
+void test_small_writes_are_coalesced_into_sectors(void)
+{
+    FlashModel model(MODEL_SIZE, FLASH_MODEL_ERASE_INLINE, false, true);
+    Update.setModel(&model);
+
+    TEST_ASSERT_TRUE(writeImage(100));
+    TEST_ASSERT_EQUAL_MEMORY(image, model.data(), IMAGE_SIZE);
+    TEST_ASSERT_EQUAL_UINT32(IMAGE_SIZE, model.written());
+    // 4 full sectors of 16 pages and 3616 bytes in 15 pages
+    TEST_ASSERT_EQUAL_UINT32(5, model.erases());
+    TEST_ASSERT_EQUAL_UINT32(4 * 16 + 15, model.pagePrograms());
+    TEST_ASSERT_EQUAL_UINT32(5 * FLASH_MODEL_ERASE_US + 79 * FLASH_MODEL_PAGE_US, model.busyTime());
+}
+
+void test_chunk_size_does_not_change_the_cost(void)
+{
+    FlashModel small(MODEL_SIZE, FLASH_MODEL_ERASE_INLINE, false);
+    FlashModel large(MODEL_SIZE, FLASH_MODEL_ERASE_INLINE, false);
+
+    Update.setModel(&small);
+    TEST_ASSERT_TRUE(writeImage(37));
+    Update.setModel(&large);
+    TEST_ASSERT_TRUE(writeImage(FLASH_MODEL_SECTOR_SIZE));
+
+    TEST_ASSERT_EQUAL_UINT32(large.erases(), small.erases());
+    TEST_ASSERT_EQUAL_UINT32(large.pagePrograms(), small.pagePrograms());
+    TEST_ASSERT_EQUAL_UINT32(large.busyTime(), small.busyTime());
+}
+
+void test_unknown_size_ends_with_the_partial_sector(void)
+{
+    FlashModel model(MODEL_SIZE, FLASH_MODEL_ERASE_INLINE, false, true);
+    Update.setModel(&model);
+
+    TEST_ASSERT_TRUE(writeImage(512, UPDATE_SIZE_UNKNOWN));
+    TEST_ASSERT_EQUAL_UINT32(IMAGE_SIZE, model.written());
+    TEST_ASSERT_EQUAL_MEMORY(image, model.data(), IMAGE_SIZE);
+}
+
+void test_erase_counts_add_up_across_images(void)
+{
+    FlashModel model(MODEL_SIZE, FLASH_MODEL_ERASE_INLINE, false, true);
+    Update.setModel(&model);
+
+    TEST_ASSERT_TRUE(writeImage(1024));
+    makeImage(1);
+    TEST_ASSERT_TRUE(writeImage(1024));
+    // the second image is stored completely, the old bits were erased first
+    TEST_ASSERT_EQUAL_MEMORY(image, model.data(), IMAGE_SIZE);
+    TEST_ASSERT_EQUAL_UINT16(2, model.maxErases());
+    TEST_ASSERT_EQUAL_UINT16(2, model.erases(0));
+    TEST_ASSERT_EQUAL_UINT16(0, model.erases(5));
+
+    model.reset();
+    TEST_ASSERT_EQUAL_UINT32(0, model.erases());
+    TEST_ASSERT_EQUAL_UINT16(0, model.maxErases());
+}
+
+void test_erase_ahead_erases_the_image_range_in_begin(void)
+{
+    FlashModel model(MODEL_SIZE, FLASH_MODEL_ERASE_AHEAD, false);
+    TEST_ASSERT_TRUE(model.begin(IMAGE_SIZE));
+    TEST_ASSERT_EQUAL_UINT32(5, model.erases());
+    TEST_ASSERT_EQUAL_UINT32(5 * FLASH_MODEL_ERASE_US, model.busyTime());
+
+    TEST_ASSERT_EQUAL(IMAGE_SIZE, model.write(image, IMAGE_SIZE));
+    TEST_ASSERT_EQUAL_UINT32(5, model.erases());
+}
+
+void test_image_without_magic_byte_is_refused(void)
+{
+    FlashModel model(MODEL_SIZE, FLASH_MODEL_ERASE_INLINE, false);
+    Update.setModel(&model);
+    image[0] = 0;
+
+    TEST_ASSERT_FALSE(writeImage(FLASH_MODEL_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL_UINT8(UPDATE_ERROR_MAGIC_BYTE, Update.getError());
+    TEST_ASSERT_FALSE(Update.isRunning());
+    TEST_ASSERT_EQUAL_UINT32(0, model.erases());
+}
+
+void test_model_refuses_images_larger_than_itself(void)
+{
+    FlashModel model(MODEL_SIZE, FLASH_MODEL_ERASE_INLINE, false);
+    TEST_ASSERT_FALSE(model.begin(MODEL_SIZE + 1));
+    TEST_ASSERT_TRUE(model.begin(MODEL_SIZE));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_small_writes_are_coalesced_into_sectors);
+    RUN_TEST(test_chunk_size_does_not_change_the_cost);
+    RUN_TEST(test_unknown_size_ends_with_the_partial_sector);
+    RUN_TEST(test_erase_counts_add_up_across_images);
+    RUN_TEST(test_erase_ahead_erases_the_image_range_in_begin);
+    RUN_TEST(test_image_without_magic_byte_is_refused);
+    RUN_TEST(test_model_refuses_images_larger_than_itself);
+    return UNITY_END();
+}
@@ -0,0 +1,212 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "GzipTrailer.cpp"
+#include "GzipStream.cpp"
+#include "ChunkedStream.cpp"
+
+typedef std::vector<uint8_t> Bytes;
+
+/// response body as the network hands it out
+class MemoryStream : public Stream
+{
+public:
+    MemoryStream(const Bytes& data) : _data(data), _pos(0)
+    {
+    }
+
+    int available()
+    {
+        return _data.size() - _pos;
+    }
+
+    int read()
+    {
+        return (_pos < _data.size()) ? _data[_pos++] : -1;
+    }
+
+    int peek()
+    {
+        return (_pos < _data.size()) ? _data[_pos] : -1;
+    }
+
+    size_t write(uint8_t)
+    {
+        return 0;
+    }
+
+private:
+    Bytes _data;
+    size_t _pos;
+};
+
+static Bytes payload(size_t len)
+{
+    Bytes data(len);
+    for(size_t i = 0; i < len; i++) {
+        data[i] = i * 13 + 5;
+    }
+    return data;
+}
+
+static void storedBlock(Bytes& out, const Bytes& data, bool final)
+{
+    out.push_back(final ? 0x01 : 0x00);
+    out.push_back(data.size() & 0xff);
+    out.push_back(data.size() >> 8);
+    out.push_back(~data.size() & 0xff);
+    out.push_back((~data.size() >> 8) & 0xff);
+    out.insert(out.end(), data.begin(), data.end());
+}
+
+/// gzip of data in stored blocks, emptyFinal ends it like a flush with an empty final block
+static Bytes gzip(const Bytes& data, bool emptyFinal)
+{
+    static const uint8_t header[10] = { 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03 };
+    Bytes out(header, header + sizeof(header));
+    storedBlock(out, data, !emptyFinal);
+    if(emptyFinal) {
+        storedBlock(out, Bytes(), true);
+    }
+    uint32_t crc = gzipCrc32(0, data.data(), data.size());
+    uint32_t total = data.size();
+    for(int i = 0; i < 4; i++) {
+        out.push_back(crc >> (8 * i));
+    }
+    for(int i = 0; i < 4; i++) {
+        out.push_back(total >> (8 * i));
+    }
+    return out;
+}
+
+/// chunked encoding of data, a chunk ends at every offset in cuts
+static Bytes chunked(const Bytes& data, const std::vector<size_t>& cuts)
+{
+    Bytes out;
+    size_t start = 0;
+    std::vector<size_t> ends(cuts);
+    ends.push_back(data.size());
+    for(size_t end : ends) {
+        char line[16];
+        snprintf(line, sizeof(line), "%x\r\n", (unsigned) (end - start));
+        out.insert(out.end(), line, line + strlen(line));
+        out.insert(out.end(), data.begin() + start, data.begin() + end);
+        out.push_back('\r');
+        out.push_back('\n');
+        start = end;
+    }
+    static const char last[] = "0\r\n\r\n";
+    out.insert(out.end(), last, last + strlen(last));
+    return out;
+}
+
+/// read exactly the image like runDeltaUpdate does, without asking for more
+static bool readImage(DecodeStream& in, const Bytes& expected)
+{
+    Bytes got(expected.size());
+    return in.readBytes((char *) got.data(), got.size()) == got.size() && got == expected;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_trailer_after_last_read(void)
+{
+    // the data ends with the second 512 byte read, the final block and the trailer come with
+    // the next one, and the trailer itself is split over two chunks
+    Bytes data = payload(1024 - 10 - 5);
+    Bytes body = gzip(data, true);
+    MemoryStream net(chunked(body, { 1000, body.size() - 4 }));
+    ChunkedStream chunks(net);
+    GzipStream inflate(chunks);
+    TEST_ASSERT_TRUE(inflate.begin());
+
+    TEST_ASSERT_TRUE(readImage(inflate, data));
+    TEST_ASSERT_FALSE(inflate.finished());
+    // the body still holds the gzip end, it is only finished once the gzip stream was read to its end
+    TEST_ASSERT_FALSE(chunks.ended());
+    TEST_ASSERT_TRUE(inflate.ended());
+    TEST_ASSERT_TRUE(chunks.ended());
+}
+
+void test_trailer_split_across_reads(void)
+{
+    // the trailer straddles the second 512 byte read and a chunk boundary
+    Bytes data = payload(1020 - 10 - 5);
+    Bytes body = gzip(data, false);
+    MemoryStream net(chunked(body, { 700, 1022 }));
+    ChunkedStream chunks(net);
+    GzipStream inflate(chunks);
+    TEST_ASSERT_TRUE(inflate.begin());
+
+    TEST_ASSERT_TRUE(readImage(inflate, data));
+    TEST_ASSERT_TRUE(inflate.ended());
+    TEST_ASSERT_TRUE(chunks.ended());
+}
+
+void test_trailer_mismatch(void)
+{
+    Bytes data = payload(1024 - 10 - 5);
+    Bytes body = gzip(data, true);
+    body[body.size() - 6] ^= 0x01;
+    MemoryStream net(chunked(body, { 1000 }));
+    ChunkedStream chunks(net);
+    GzipStream inflate(chunks);
+    TEST_ASSERT_TRUE(inflate.begin());
+
+    TEST_ASSERT_TRUE(readImage(inflate, data));
+    TEST_ASSERT_FALSE(inflate.ended());
+    TEST_ASSERT_TRUE(inflate.failed());
+}
+
+void test_data_after_image(void)
+{
+    // a patch that ends before the decoded data does is not a complete image
+    Bytes data = payload(600);
+    MemoryStream net(chunked(gzip(data, true), { 300 }));
+    ChunkedStream chunks(net);
+    GzipStream inflate(chunks);
+    TEST_ASSERT_TRUE(inflate.begin());
+
+    Bytes head(data.begin(), data.end() - 1);
+    TEST_ASSERT_TRUE(readImage(inflate, head));
+    TEST_ASSERT_FALSE(inflate.ended());
+}
+
+void test_body_cut_short(void)
+{
+    Bytes data = payload(1024 - 10 - 5);
+    Bytes body = gzip(data, true);
+    Bytes net = chunked(body, { 1000 });
+    net.resize(net.size() - 5);
+    MemoryStream src(net);
+    ChunkedStream chunks(src);
+    GzipStream inflate(chunks);
+    TEST_ASSERT_TRUE(inflate.begin());
+
+    TEST_ASSERT_TRUE(readImage(inflate, data));
+    TEST_ASSERT_TRUE(inflate.ended());
+    TEST_ASSERT_FALSE(chunks.ended());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_trailer_after_last_read);
+    RUN_TEST(test_trailer_split_across_reads);
+    RUN_TEST(test_trailer_mismatch);
+    RUN_TEST(test_data_after_image);
+    RUN_TEST(test_body_cut_short);
+    return UNITY_END();
+}
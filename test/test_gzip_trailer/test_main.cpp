@@ -0,0 +1,99 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include <string.h>
+#include "GzipTrailer.cpp"
+
+// trailer of `printf 'hello\n' | gzip -n`
+static const uint8_t helloTrailer[GZIP_TRAILER_SIZE] = { 0x20, 0x30, 0x3a, 0x36, 0x06, 0x00, 0x00, 0x00 };
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_crc_check_value(void)
+{
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, gzipCrc32(0, (const uint8_t *) "123456789", 9));
+    TEST_ASSERT_EQUAL_HEX32(0, gzipCrc32(0, NULL, 0));
+}
+
+void test_crc_in_pieces(void)
+{
+    // the stream feeds the crc one decoded window at a time
+    uint8_t data[1000];
+    for(size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7;
+    }
+    uint32_t crc = 0;
+    for(size_t done = 0; done < sizeof(data); done += 33) {
+        crc = gzipCrc32(crc, data + done, (sizeof(data) - done > 33) ? 33 : sizeof(data) - done);
+    }
+    TEST_ASSERT_EQUAL_HEX32(gzipCrc32(0, data, sizeof(data)), crc);
+}
+
+void test_trailer_matches(void)
+{
+    uint32_t crc = gzipCrc32(0, (const uint8_t *) "hello\n", 6);
+    TEST_ASSERT_TRUE(gzipTrailerMatches(helloTrailer, crc, 6));
+}
+
+void test_trailer_mismatch(void)
+{
+    uint32_t crc = gzipCrc32(0, (const uint8_t *) "hello\n", 6);
+    TEST_ASSERT_FALSE(gzipTrailerMatches(helloTrailer, crc ^ 1, 6));
+    // a truncated image with the right crc prefix still fails on the size
+    TEST_ASSERT_FALSE(gzipTrailerMatches(helloTrailer, crc, 5));
+    TEST_ASSERT_FALSE(gzipTrailerMatches(helloTrailer, crc, 6 + 0x100));
+}
+
+void test_trailer_from_bits(void)
+{
+    // 3 padding bits after the last deflate block, then 4 trailer bytes already in the bit buffer
+    uint64_t bitBuf = 0x5;
+    for(int i = 0; i < 4; i++) {
+        bitBuf |= (uint64_t) helloTrailer[i] << (3 + 8 * i);
+    }
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+    memset(trailer, 0, sizeof(trailer));
+    TEST_ASSERT_EQUAL(4, gzipTrailerFromBits(bitBuf, 3 + 32, trailer));
+    TEST_ASSERT_EQUAL_MEMORY(helloTrailer, trailer, 4);
+}
+
+void test_trailer_from_no_whole_byte(void)
+{
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+    TEST_ASSERT_EQUAL(0, gzipTrailerFromBits(0x7f, 7, trailer));
+    TEST_ASSERT_EQUAL(0, gzipTrailerFromBits(0, 0, trailer));
+}
+
+void test_trailer_from_full_buffer(void)
+{
+    // a 64 bit buffer never yields more than the trailer
+    uint64_t bitBuf = 0;
+    for(int i = 0; i < 8; i++) {
+        bitBuf |= (uint64_t) helloTrailer[i] << (8 * i);
+    }
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+    TEST_ASSERT_EQUAL(GZIP_TRAILER_SIZE, gzipTrailerFromBits(bitBuf, 64, trailer));
+    TEST_ASSERT_EQUAL_MEMORY(helloTrailer, trailer, GZIP_TRAILER_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_crc_check_value);
+    RUN_TEST(test_crc_in_pieces);
+    RUN_TEST(test_trailer_matches);
+    RUN_TEST(test_trailer_mismatch);
+    RUN_TEST(test_trailer_from_bits);
+    RUN_TEST(test_trailer_from_no_whole_byte);
+    RUN_TEST(test_trailer_from_full_buffer);
+    return UNITY_END();
+}
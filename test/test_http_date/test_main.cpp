@@ -0,0 +1,75 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include "AsvinHttpDate.cpp"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_rfc_example(void)
+{
+    TEST_ASSERT_EQUAL(784111777, asvinParseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT"));
+}
+
+void test_epoch(void)
+{
+    TEST_ASSERT_EQUAL(1, asvinParseHttpDate("Thu, 01 Jan 1970 00:00:01 GMT"));
+    TEST_ASSERT_EQUAL(86400, asvinParseHttpDate("Fri, 02 Jan 1970 00:00:00 GMT"));
+}
+
+void test_leap_years(void)
+{
+    // 2020 is a leap year, 2100 is not, 2000 is
+    TEST_ASSERT_EQUAL(1582934400, asvinParseHttpDate("Sat, 29 Feb 2020 00:00:00 GMT"));
+    TEST_ASSERT_EQUAL(1583020800, asvinParseHttpDate("Sun, 01 Mar 2020 00:00:00 GMT"));
+    TEST_ASSERT_EQUAL(951782400, asvinParseHttpDate("Tue, 29 Feb 2000 00:00:00 GMT"));
+    TEST_ASSERT_EQUAL(4107542400LL, asvinParseHttpDate("Mon, 01 Mar 2100 00:00:00 GMT"));
+}
+
+void test_every_month(void)
+{
+    static const char* dates[] = {
+        "Wed, 01 Jan 2025 00:00:00 GMT", "Sat, 01 Feb 2025 00:00:00 GMT", "Sat, 01 Mar 2025 00:00:00 GMT",
+        "Tue, 01 Apr 2025 00:00:00 GMT", "Thu, 01 May 2025 00:00:00 GMT", "Sun, 01 Jun 2025 00:00:00 GMT",
+        "Tue, 01 Jul 2025 00:00:00 GMT", "Fri, 01 Aug 2025 00:00:00 GMT", "Mon, 01 Sep 2025 00:00:00 GMT",
+        "Wed, 01 Oct 2025 00:00:00 GMT", "Sat, 01 Nov 2025 00:00:00 GMT", "Mon, 01 Dec 2025 00:00:00 GMT"
+    };
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    time_t t = 1735689600;
+    for(int i = 0; i < 12; i++) {
+        TEST_ASSERT_EQUAL(t, asvinParseHttpDate(dates[i]));
+        t += days[i] * 86400;
+    }
+}
+
+void test_rejected(void)
+{
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate(""));
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate("Sun, 06 Foo 1994 08:49:37 GMT"));
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate("Sun, 06 anF 1994 08:49:37 GMT"));
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate("Sun, 06 Nov 1994 08:49 GMT"));
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate("Sun, 32 Nov 1994 08:49:37 GMT"));
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate("Sun, 06 Nov 1994 24:49:37 GMT"));
+    // the obsolete RFC 850 and asctime forms are not used by the asvin servers
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate("Sunday, 06-Nov-94 08:49:37 GMT"));
+    TEST_ASSERT_EQUAL(0, asvinParseHttpDate("Sun Nov  6 08:49:37 1994"));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_rfc_example);
+    RUN_TEST(test_epoch);
+    RUN_TEST(test_leap_years);
+    RUN_TEST(test_every_month);
+    RUN_TEST(test_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,59 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include "ImageState.cpp"
+
+#define OLD_TAG     "\"bafkreiold\""
+#define NEW_TAG     "\"bafkreinew\""
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_running(void)
+{
+    TEST_ASSERT_EQUAL(IMAGE_RUNNING, imageState(NEW_TAG, NEW_TAG, "", ""));
+}
+
+void test_boot_partition_pending(void)
+{
+    // written without stage only and not rebooted yet: the new image is the boot partition
+    TEST_ASSERT_EQUAL(IMAGE_PENDING, imageState(NEW_TAG, OLD_TAG, NEW_TAG, ""));
+}
+
+void test_staged_pending(void)
+{
+    TEST_ASSERT_EQUAL(IMAGE_PENDING, imageState(NEW_TAG, OLD_TAG, "", NEW_TAG));
+}
+
+void test_gone(void)
+{
+    // overwritten by another update, or rolled back
+    TEST_ASSERT_EQUAL(IMAGE_UNKNOWN, imageState(NEW_TAG, OLD_TAG, "", ""));
+    TEST_ASSERT_EQUAL(IMAGE_UNKNOWN, imageState(NEW_TAG, OLD_TAG, "\"bafkreiother\"", "\"bafkreiother\""));
+}
+
+void test_empty_tag(void)
+{
+    TEST_ASSERT_EQUAL(IMAGE_UNKNOWN, imageState("", "", "", ""));
+    TEST_ASSERT_EQUAL(IMAGE_UNKNOWN, imageState(NULL, OLD_TAG, NULL, NULL));
+    TEST_ASSERT_EQUAL(IMAGE_UNKNOWN, imageState(NEW_TAG, NULL, NULL, NULL));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_running);
+    RUN_TEST(test_boot_partition_pending);
+    RUN_TEST(test_staged_pending);
+    RUN_TEST(test_gone);
+    RUN_TEST(test_empty_tag);
+    return UNITY_END();
+}
@@ -0,0 +1,188 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include <stdio.h>
+#define NO_GLOBAL_ASVINREPORTS
+#include "AsvinReports.cpp"
+
+static asvin_report_t reportOf(int n)
+{
+    asvin_report_t report;
+    memset(&report, 0, sizeof(report));
+    snprintf(report.rolloutID, sizeof(report.rolloutID), "rollout-%d", n);
+    snprintf(report.version, sizeof(report.version), "1.0.%d", n);
+    report.result = n;
+    return report;
+}
+
+// -1 if there is no report at index
+static int resultAt(AsvinReports& reports, size_t index)
+{
+    asvin_report_t report;
+    return reports.get(index, report) ? report.result : -1;
+}
+
+void setUp(void)
+{
+    Preferences::clear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_empty_before_first_report(void)
+{
+    AsvinReports reports;
+    asvin_report_t report;
+    TEST_ASSERT_EQUAL(0, reports.pending());
+    TEST_ASSERT_FALSE(reports.peek(report));
+    reports.pop();
+    TEST_ASSERT_EQUAL(0, reports.pending());
+}
+
+void test_oldest_first(void)
+{
+    AsvinReports reports;
+    for(int n = 1; n <= 3; n++) {
+        TEST_ASSERT_TRUE(reports.push(reportOf(n)));
+    }
+    asvin_report_t report;
+    for(int n = 1; n <= 3; n++) {
+        TEST_ASSERT_TRUE(reports.peek(report));
+        TEST_ASSERT_EQUAL(n, report.result);
+        TEST_ASSERT_EQUAL_STRING(reportOf(n).rolloutID, report.rolloutID);
+        reports.pop();
+    }
+    TEST_ASSERT_EQUAL(0, reports.pending());
+}
+
+void test_full_ring_drops_oldest(void)
+{
+    AsvinReports reports;
+    for(int n = 1; n <= ASVIN_REPORT_QUEUE_SIZE + 3; n++) {
+        TEST_ASSERT_TRUE(reports.push(reportOf(n)));
+    }
+    TEST_ASSERT_EQUAL(ASVIN_REPORT_QUEUE_SIZE, reports.pending());
+    for(size_t i = 0; i < ASVIN_REPORT_QUEUE_SIZE; i++) {
+        TEST_ASSERT_EQUAL(4 + (int) i, resultAt(reports, i));
+    }
+}
+
+void test_survives_reboot(void)
+{
+    {
+        AsvinReports reports;
+        // wrap the head around the ring first
+        for(int n = 1; n <= ASVIN_REPORT_QUEUE_SIZE - 2; n++) {
+            reports.push(reportOf(n));
+            reports.pop();
+        }
+        for(int n = 10; n < 15; n++) {
+            reports.push(reportOf(n));
+        }
+    }
+    AsvinReports reports;
+    TEST_ASSERT_EQUAL(5, reports.pending());
+    for(size_t i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(10 + (int) i, resultAt(reports, i));
+    }
+}
+
+void test_remove_keeps_order(void)
+{
+    AsvinReports reports;
+    // start near the end of the ring so the moved records wrap
+    for(int n = 0; n < ASVIN_REPORT_QUEUE_SIZE - 2; n++) {
+        reports.push(reportOf(0));
+        reports.pop();
+    }
+    for(int n = 1; n <= 5; n++) {
+        reports.push(reportOf(n));
+    }
+    reports.remove(2);
+    reports.remove(3);
+    reports.remove(7);
+    TEST_ASSERT_EQUAL(3, reports.pending());
+    TEST_ASSERT_EQUAL(1, resultAt(reports, 0));
+    TEST_ASSERT_EQUAL(2, resultAt(reports, 1));
+    TEST_ASSERT_EQUAL(4, resultAt(reports, 2));
+
+    // the freed slots are used again in order
+    reports.push(reportOf(6));
+    AsvinReports rebooted;
+    TEST_ASSERT_EQUAL(4, rebooted.pending());
+    TEST_ASSERT_EQUAL(6, resultAt(rebooted, 3));
+}
+
+void test_damaged_record_skipped(void)
+{
+    AsvinReports reports;
+    for(int n = 1; n <= 3; n++) {
+        reports.push(reportOf(n));
+    }
+    // a record of an older, shorter layout in the first slot
+    Preferences::raw(REPORTS_NAMESPACE)["r0"].resize(sizeof(asvin_report_t) - 64);
+    asvin_report_t report;
+    TEST_ASSERT_TRUE(reports.peek(report));
+    TEST_ASSERT_EQUAL(2, report.result);
+    TEST_ASSERT_EQUAL(2, reports.pending());
+}
+
+void test_strings_terminated(void)
+{
+    AsvinReports reports;
+    asvin_report_t full;
+    memset(&full, 'x', sizeof(full));
+    reports.push(full);
+    asvin_report_t report;
+    TEST_ASSERT_TRUE(reports.peek(report));
+    TEST_ASSERT_EQUAL(sizeof(report.rolloutID) - 1, strlen(report.rolloutID));
+    TEST_ASSERT_EQUAL(sizeof(report.version) - 1, strlen(report.version));
+    TEST_ASSERT_EQUAL(sizeof(report.tag) - 1, strlen(report.tag));
+}
+
+void test_bad_count_is_empty(void)
+{
+    {
+        AsvinReports reports;
+        reports.push(reportOf(1));
+    }
+    Preferences prefs;
+    prefs.begin(REPORTS_NAMESPACE, false);
+    prefs.putUChar("count", ASVIN_REPORT_QUEUE_SIZE + 1);
+    prefs.end();
+    AsvinReports reports;
+    TEST_ASSERT_EQUAL(0, reports.pending());
+}
+
+void test_contains(void)
+{
+    AsvinReports reports;
+    TEST_ASSERT_FALSE(reports.contains("rollout-1"));
+    reports.push(reportOf(1));
+    reports.push(reportOf(2));
+    TEST_ASSERT_TRUE(reports.contains("rollout-1"));
+    TEST_ASSERT_TRUE(reports.contains("rollout-2"));
+    TEST_ASSERT_FALSE(reports.contains("rollout-3"));
+    reports.pop();
+    TEST_ASSERT_FALSE(reports.contains("rollout-1"));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_before_first_report);
+    RUN_TEST(test_oldest_first);
+    RUN_TEST(test_full_ring_drops_oldest);
+    RUN_TEST(test_survives_reboot);
+    RUN_TEST(test_remove_keeps_order);
+    RUN_TEST(test_damaged_record_skipped);
+    RUN_TEST(test_strings_terminated);
+    RUN_TEST(test_bad_count_is_empty);
+    RUN_TEST(test_contains);
+    return UNITY_END();
+}
@@ -0,0 +1,111 @@
+/**
+ * test_main.cpp
+ *
+ * Copyright (c) 2019 asvin.io. All rights reserved.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "AsvinSlot.cpp"
+
+#define DEVICES   (1000)
+#define WINDOW    (3600)
+#define BUCKETS   (10)
+
+static void macOf(uint32_t n, char* mac)
+{
+    // consecutive devices of one vendor, the worst case for a weak hash
+    sprintf(mac, "24:6F:28:%02X:%02X:%02X", (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_offset_in_window(void)
+{
+    char mac[18];
+    for(uint32_t n = 0; n < DEVICES; n++) {
+        macOf(n, mac);
+        TEST_ASSERT_LESS_THAN(WINDOW, asvinSlotOffset(mac, "5f1a2b", WINDOW));
+        TEST_ASSERT_LESS_THAN(7, asvinSlotOffset(mac, "5f1a2b", 7));
+    }
+}
+
+void test_no_window(void)
+{
+    TEST_ASSERT_EQUAL(0, asvinSlotOffset("24:6F:28:00:00:01", "5f1a2b", 0));
+}
+
+void test_offset_deterministic(void)
+{
+    TEST_ASSERT_EQUAL(asvinSlotOffset("24:6F:28:00:00:01", "5f1a2b", WINDOW),
+                      asvinSlotOffset("24:6F:28:00:00:01", "5f1a2b", WINDOW));
+}
+
+void test_offset_spread(void)
+{
+    uint32_t count[BUCKETS] = { 0 };
+    char mac[18];
+    for(uint32_t n = 0; n < DEVICES; n++) {
+        macOf(n, mac);
+        count[asvinSlotOffset(mac, "5f1a2b", WINDOW) * BUCKETS / WINDOW]++;
+    }
+    // 100 per bucket on average, no part of the window may get a burst
+    for(uint32_t b = 0; b < BUCKETS; b++) {
+        TEST_ASSERT_GREATER_THAN(DEVICES / BUCKETS / 2, count[b]);
+        TEST_ASSERT_LESS_THAN(DEVICES / BUCKETS * 3 / 2, count[b]);
+    }
+}
+
+void test_offset_per_rollout(void)
+{
+    // the same devices come in a different order in the next campaign
+    char mac[18];
+    uint32_t same = 0;
+    for(uint32_t n = 0; n < DEVICES; n++) {
+        macOf(n, mac);
+        uint32_t a = asvinSlotOffset(mac, "5f1a2b", WINDOW) * BUCKETS / WINDOW;
+        uint32_t b = asvinSlotOffset(mac, "5f1a2c", WINDOW) * BUCKETS / WINDOW;
+        same += (a == b);
+    }
+    TEST_ASSERT_LESS_THAN(DEVICES / BUCKETS * 2, same);
+}
+
+void test_seen_kept(void)
+{
+    asvin_slot_t slot;
+    memset(&slot, 0, sizeof(slot));
+    TEST_ASSERT_EQUAL(1000, asvinSlotSeen(slot, "5f1a2b", 1000));
+    TEST_ASSERT_EQUAL(1000, asvinSlotSeen(slot, "5f1a2b", 2000));
+    TEST_ASSERT_EQUAL(3000, asvinSlotSeen(slot, "5f1a2c", 3000));
+}
+
+void test_seen_long_id(void)
+{
+    char id[100];
+    memset(id, 'a', sizeof(id) - 1);
+    id[sizeof(id) - 1] = 0;
+    asvin_slot_t slot;
+    memset(&slot, 0, sizeof(slot));
+    TEST_ASSERT_EQUAL(1000, asvinSlotSeen(slot, id, 1000));
+    TEST_ASSERT_EQUAL(1000, asvinSlotSeen(slot, id, 2000));
+    TEST_ASSERT_EQUAL(sizeof(slot.id) - 1, strlen(slot.id));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_offset_in_window);
+    RUN_TEST(test_no_window);
+    RUN_TEST(test_offset_deterministic);
+    RUN_TEST(test_offset_spread);
+    RUN_TEST(test_offset_per_rollout);
+    RUN_TEST(test_seen_kept);
+    RUN_TEST(test_seen_long_id);
+    return UNITY_END();
+}